@@ -0,0 +1,1107 @@
+/*
+    Nanochord.Tetris
+
+    Microbenchmarks of the Playfield and Tetris hot paths
+
+    MIT License - see Tetris.h for details.
+
+    Build from the repository root with any C++11 compiler, e.g.:
+        g++ -std=c++11 -O2 -pthread -I src/Cpp src/Benchmarks/TetrisBench.cpp -o TetrisBench
+
+    Usage:
+        TetrisBench [--quick] [--min-time=<seconds>] [--filter=<text>] > results.json
+
+    Every benchmark is run for each board size and fill density. The fill density is the ratio of occupied cells
+    in the lower half of the board (every row keeps at least one hole, so no row is complete). The results are
+    written to the standard output as a single JSON document.
+    Define TETRIS_STATE_HASH to run the games with the incremental state hash and to add the StateHash cases.
+    Define TETRIS_SIMD to run the Playfield cases with the vectorized full row test; the RowKernel cases compare
+    the kernels of TetrisSimd.h with the byte loop GetCompletedRows used before.
+ */
+
+#include "Tetris.h"
+#include "TetrisHeadless.h"
+#include "TetrisFeatures.h"
+#include "TetrisFixed.h"
+#include "TetrisPolyomino.h"
+#include "TetrisReplay.h"
+#include "TetrisRollout.h"
+#include "TetrisRotation.h"
+#include "TetrisSimd.h"
+#include "TetrisSpectator.h"
+#include "TetrisVersus.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+using namespace Nanochord;
+
+namespace
+{
+    struct BoardSize
+    {
+        int Columns;
+        int Rows;
+    };
+
+    const BoardSize BoardSizes[] = { { 10, 20 }, { 40, 100 }, { 100, 1000 }, { 1000, 10000 } };
+    const double FillDensities[] = { 0.0, 0.3, 0.6, 0.9 };
+
+    const int QueryCount = 1024;
+    const int GamePieceLimit = 1000;
+    const int LargeGamePieceLimit = 100;    // for boards above 100k cells
+    const int RolloutHorizon = 10;
+    const int RolloutsPerCandidate = 16;
+
+    volatile int g_Sink = 0;
+
+    struct Options
+    {
+        double MinTime = 0.2;
+        bool Quick = false;
+        const char* Filter = NULL;
+    };
+
+    Options g_Options;
+
+    typedef std::chrono::steady_clock Clock;
+
+    double ElapsedNs(Clock::time_point from, Clock::time_point to)
+    {
+        return (double)std::chrono::duration_cast<std::chrono::nanoseconds>(to - from).count();
+    }
+
+    /// <summary>
+    /// Result of a single benchmark case
+    /// </summary>
+    struct Measurement
+    {
+        long long Iterations = 0;
+        double TotalNs = 0;
+        double Work = 0;            // benchmark specific amount of work, e.g. the number of pieces in games
+    };
+
+    /// <summary>
+    /// Collects the measurements and writes them as JSON
+    /// </summary>
+    class Reporter
+    {
+    public:
+        void Begin()
+        {
+            printf("{\n  \"library\": \"Nanochord.Tetris\",\n  \"min_time_s\": %g,\n  \"benchmarks\": [", g_Options.MinTime);
+        }
+
+        void Add(const char* name, const BoardSize& size, double fill, const Measurement& m, const char* workUnit = NULL)
+        {
+            double nsPerOp = m.Iterations > 0 ? m.TotalNs / m.Iterations : 0;
+
+            printf("%s\n    { \"name\": \"%s\", \"columns\": %d, \"rows\": %d, \"fill\": %.2f, \"iterations\": %lld, "
+                "\"ns_per_op\": %.3f, \"ops_per_sec\": %.1f",
+                m_Count == 0 ? "" : ",", name, size.Columns, size.Rows, fill, m.Iterations,
+                nsPerOp, nsPerOp > 0 ? 1e9 / nsPerOp : 0.0);
+
+            if (workUnit != NULL)
+                printf(", \"%s_per_sec\": %.1f", workUnit, m.TotalNs > 0 ? m.Work * 1e9 / m.TotalNs : 0.0);
+
+            printf(" }");
+            fflush(stdout);
+            m_Count++;
+        }
+
+        void End()
+        {
+            printf("\n  ]\n}\n");
+        }
+
+    protected:
+        int m_Count = 0;
+    };
+
+    Reporter g_Reporter;
+
+    bool IsSelected(const char* name)
+    {
+        return g_Options.Filter == NULL || strstr(name, g_Options.Filter) != NULL;
+    }
+
+    // Runs fn(n) with a growing batch size until the minimum time is reached. fn has to execute n operations.
+    template <class F>
+    Measurement MeasureBatch(F fn)
+    {
+        Measurement m;
+        long long n = 1;
+
+        fn(1); // warm-up
+
+        for (;;)
+        {
+            Clock::time_point start = Clock::now();
+            fn(n);
+            double ns = ElapsedNs(start, Clock::now());
+
+            m.Iterations += n;
+            m.TotalNs += ns;
+
+            if (m.TotalNs >= g_Options.MinTime * 1e9)
+                break;
+
+            if (ns < 1e7)
+                n *= 2;
+        }
+
+        return m;
+    }
+
+    // Times fn() one by one, calling the untimed setup() before each of them. fn returns the amount of work done.
+    template <class S, class F>
+    Measurement MeasureEach(S setup, F fn)
+    {
+        Measurement m;
+        Clock::time_point wallStart = Clock::now();
+
+        do
+        {
+            setup();
+
+            Clock::time_point start = Clock::now();
+            m.Work += fn();
+            m.TotalNs += ElapsedNs(start, Clock::now());
+            m.Iterations++;
+        } while (m.TotalNs < g_Options.MinTime * 1e9 && ElapsedNs(wallStart, Clock::now()) < g_Options.MinTime * 20e9);
+
+        return m;
+    }
+
+    int StackHeight(const Playfield& pf)
+    {
+        return pf.GetRows() / 2;
+    }
+
+    void FillRow(Playfield& pf, int y, double density, HeadlessHost& rng)
+    {
+        int cols = pf.GetColumns();
+        int threshold = (int)(density * 1000);
+
+        for (int x = 0; x < cols; x++)
+            pf.SetCell(x, y, rng.Random(1000) < threshold ? (byte)(1 + rng.Random(7)) : 0);
+
+        pf.SetCell(rng.Random(cols), y, 0);
+    }
+
+    void FillBoard(Playfield& pf, double density, uint64_t seed)
+    {
+        HeadlessHost rng(seed);
+
+        pf.Clear();
+        for (int y = 0; y < StackHeight(pf); y++)
+            FillRow(pf, y, density, rng);
+    }
+
+    /// <summary>
+    /// Tetris game with access to its internals for the benchmarks
+    /// </summary>
+    class BenchTetris : public Tetris
+    {
+    public:
+        BenchTetris(Host* pHost, int rows, int cols) : Tetris(pHost, rows, cols)
+        {
+        }
+
+        Playfield& GetPlayfield() { return m_Playfield; }
+
+        // Puts the current block back to the top middle of the playfield
+        void ResetCurrentBlock(int y)
+        {
+            m_GameOver = false;
+            m_IsPaused = false;
+            m_pCurrentBlock->X = m_Playfield.GetColumns() / 2;
+            m_pCurrentBlock->Y = y;
+            m_pCurrentBlock->OriIndex = 0;
+        }
+    };
+
+    /// <summary>
+    /// One instance of every kind of blocks
+    /// </summary>
+    struct BlockSet
+    {
+        Block_O O;
+        Block_I I;
+        Block_S S;
+        Block_Z Z;
+        Block_L L;
+        Block_J J;
+        Block_T T;
+
+        Block* Get(int index)
+        {
+            Block* blocks[7] = { &O, &I, &S, &Z, &L, &J, &T };
+            return blocks[index % 7];
+        }
+    };
+
+    void BenchPlayfield(const BoardSize& size, double fill)
+    {
+        HeadlessHost host(1);
+        Playfield pf(&host, size.Rows, size.Columns);
+        FillBoard(pf, fill, 42);
+
+        BlockSet blocks;
+        HeadlessHost rng(7);
+
+        if (IsSelected("Playfield.PlacementTest"))
+        {
+            struct Query { const byte* Bitmap; int X; int Y; };
+            std::vector<Query> queries(QueryCount);
+            for (Query& q : queries)
+            {
+                Block* pBlock = blocks.Get(rng.Random(7));
+                q.Bitmap = pBlock->OriBitmaps[rng.Random(pBlock->OriCount)];
+                q.X = rng.Random(size.Columns);
+                q.Y = rng.Random(size.Rows);
+            }
+
+            Measurement m = MeasureBatch([&](long long n)
+            {
+                int acc = 0;
+                for (long long i = 0; i < n; i++)
+                {
+                    const Query& q = queries[i & (QueryCount - 1)];
+                    acc += pf.PlacementTest(q.Bitmap, q.X, q.Y);
+                }
+                g_Sink += acc;
+            });
+            g_Reporter.Add("Playfield.PlacementTest", size, fill, m);
+        }
+
+        if (IsSelected("Playfield.IsPositionEmpty"))
+        {
+            std::vector<int> xs(QueryCount), ys(QueryCount);
+            for (int i = 0; i < QueryCount; i++)
+            {
+                xs[i] = rng.Random(size.Columns);
+                ys[i] = rng.Random(size.Rows);
+            }
+
+            Measurement m = MeasureBatch([&](long long n)
+            {
+                int acc = 0;
+                for (long long i = 0; i < n; i++)
+                    acc += pf.IsPositionEmpty(xs[i & (QueryCount - 1)], ys[i & (QueryCount - 1)]);
+                g_Sink += acc;
+            });
+            g_Reporter.Add("Playfield.IsPositionEmpty", size, fill, m);
+        }
+
+        if (IsSelected("Playfield.GetCompletedRows"))
+        {
+            Measurement m = MeasureBatch([&](long long n)
+            {
+                int acc = 0;
+                for (long long i = 0; i < n; i++)
+                    acc += pf.GetCompletedRows();
+                g_Sink += acc;
+            });
+            g_Reporter.Add("Playfield.GetCompletedRows", size, fill, m);
+        }
+
+        // An empty board has no row to clear, ClearRow would return at once
+        if (IsSelected("Playfield.ClearRow") && fill > 0)
+        {
+            // The stack height is kept constant by refilling its top row after every clear
+            int top = StackHeight(pf) - 1;
+
+            Measurement m = MeasureEach(
+                [&]() { FillRow(pf, top, fill, rng); },
+                [&]() { pf.ClearRow(0); return 1.0; });
+            g_Reporter.Add("Playfield.ClearRow", size, fill, m);
+        }
+
+        if (IsSelected("Playfield.Occupy"))
+        {
+            std::vector<Block*> queries(QueryCount);
+            std::vector<Block*> owned;
+            for (int i = 0; i < QueryCount; i++)
+            {
+                Block* pBlock = NULL;
+                switch (i % 7)
+                {
+                case 0: pBlock = new Block_O(); break;
+                case 1: pBlock = new Block_I(); break;
+                case 2: pBlock = new Block_S(); break;
+                case 3: pBlock = new Block_Z(); break;
+                case 4: pBlock = new Block_L(); break;
+                case 5: pBlock = new Block_J(); break;
+                default: pBlock = new Block_T(); break;
+                }
+                pBlock->OriIndex = rng.Random(pBlock->OriCount);
+                pBlock->X = 2 + rng.Random(size.Columns - 4);
+                pBlock->Y = 2 + rng.Random(size.Rows - 4);
+                queries[i] = pBlock;
+                owned.push_back(pBlock);
+            }
+
+            Measurement m = MeasureBatch([&](long long n)
+            {
+                for (long long i = 0; i < n; i++)
+                    pf.Occupy(queries[i & (QueryCount - 1)]);
+            });
+            g_Reporter.Add("Playfield.Occupy", size, fill, m);
+
+            for (Block* pBlock : owned)
+                delete pBlock;
+        }
+    }
+
+    void BenchTetrisActions(const BoardSize& size, double fill)
+    {
+        HeadlessHost host(3);
+        BenchTetris tetris(&host, size.Rows, size.Columns);
+        tetris.Start();
+        FillBoard(tetris.GetPlayfield(), fill, 42);
+
+        if (IsSelected("Tetris.Rotate"))
+        {
+            tetris.ResetCurrentBlock(size.Rows - 3);
+
+            Measurement m = MeasureBatch([&](long long n)
+            {
+                for (long long i = 0; i < n; i++)
+                    tetris.Rotate();
+            });
+            g_Reporter.Add("Tetris.Rotate", size, fill, m);
+        }
+
+        if (IsSelected("Tetris.RotateSrs"))
+        {
+            SrsRotationSystem srs;
+            tetris.SetRotationSystem(&srs);
+            tetris.ResetCurrentBlock(size.Rows - 3);
+
+            Measurement m = MeasureBatch([&](long long n)
+            {
+                for (long long i = 0; i < n; i++)
+                    tetris.Rotate();
+            });
+            g_Reporter.Add("Tetris.RotateSrs", size, fill, m);
+            tetris.SetRotationSystem(NULL);
+        }
+
+        if (IsSelected("Tetris.Drop"))
+        {
+            // Only the stack and the rows right above it can change during a drop
+            Playfield& pf = tetris.GetPlayfield();
+            int savedRows = StackHeight(pf) + 4;
+            std::vector<byte> saved(savedRows * size.Columns);
+            for (int y = 0; y < savedRows; y++)
+                memcpy(&saved[y * size.Columns], pf.Map[y], size.Columns);
+
+            Measurement m = MeasureEach(
+                [&]()
+                {
+                    for (int y = 0; y < savedRows; y++)
+                        memcpy(pf.Map[y], &saved[y * size.Columns], size.Columns);
+                    pf.RecalculateHeight();
+                    tetris.ResetCurrentBlock(size.Rows - 1);
+                },
+                [&]() { g_Sink += tetris.Drop(); return 1.0; });
+            g_Reporter.Add("Tetris.Drop", size, fill, m);
+        }
+
+#ifdef TETRIS_STATE_HASH
+        // The incremental hash read every tick, and the hash of every cell it replaces
+        tetris.RecalculateStateHash();
+
+        if (IsSelected("StateHash.Get"))
+        {
+            // The game is read through a volatile pointer, so the unchanged hash is not computed only once
+            BenchTetris* volatile pTetris = &tetris;
+
+            Measurement m = MeasureBatch([&](long long n)
+            {
+                uint64_t acc = 0;
+                for (long long i = 0; i < n; i++)
+                    acc += pTetris->GetStateHash();
+                g_Sink ^= (int)(acc >> 32);
+            });
+            g_Reporter.Add("StateHash.Get", size, fill, m);
+        }
+
+        if (IsSelected("StateHash.Recalculate"))
+        {
+            Measurement m = MeasureBatch([&](long long n)
+            {
+                uint64_t acc = 0;
+                for (long long i = 0; i < n; i++)
+                {
+                    tetris.RecalculateStateHash();
+                    acc += tetris.GetStateHash();
+                }
+                g_Sink ^= (int)(acc >> 32);
+            });
+            g_Reporter.Add("StateHash.Recalculate", size, fill, m);
+        }
+#endif
+    }
+
+    void BenchFeatures(const BoardSize& size, double fill)
+    {
+        HeadlessHost host(1);
+        FeaturePlayfield pf(&host, size.Rows, size.Columns);
+        FillBoard(pf, fill, 42);
+
+        BlockSet blocks;
+        HeadlessHost rng(9);
+
+        if (IsSelected("Features.Recalculate"))
+        {
+            Measurement m = MeasureBatch([&](long long n)
+            {
+                int acc = 0;
+                for (long long i = 0; i < n; i++)
+                {
+                    pf.RecalculateFeatures();
+                    acc += pf.GetFeatures().Holes;
+                }
+                g_Sink += acc;
+            });
+            g_Reporter.Add("Features.Recalculate", size, fill, m);
+        }
+
+        if (IsSelected("Features.Occupy"))
+        {
+            // The blocks are placed right above the stack, which is restored when it grows too high
+            Block* pBlock = NULL;
+            Measurement m = MeasureEach(
+                [&]()
+                {
+                    if (pf.GetHeight() > size.Rows - 4)
+                        FillBoard(pf, fill, 42);
+
+                    pBlock = blocks.Get(rng.Random(7));
+                    pBlock->OriIndex = rng.Random(pBlock->OriCount);
+                    pBlock->X = 2 + rng.Random(size.Columns - 4);
+                    pBlock->Y = pf.GetHeight() + 1;
+                },
+                [&]()
+                {
+                    pf.Occupy(pBlock);
+                    g_Sink += pf.GetFeatures().Bumpiness;
+                    return 1.0;
+                });
+            g_Reporter.Add("Features.Occupy", size, fill, m);
+            FillBoard(pf, fill, 42);
+        }
+
+        if (IsSelected("Features.BitBoard") && size.Columns <= BitBoard::MaxColumns)
+        {
+            // Candidate boards: a random placement on top of the stack, then the complete rows are removed
+            std::vector<uint64_t> board(size.Rows), candidate(size.Rows);
+            BitBoard::FromPlayfield(pf, board.data());
+
+            Measurement m = MeasureBatch([&](long long n)
+            {
+                int acc = 0;
+                BoardFeatures features;
+                for (long long i = 0; i < n; i++)
+                {
+                    Block* pBlock = blocks.Get((int)i);
+                    memcpy(candidate.data(), board.data(), size.Rows * sizeof(uint64_t));
+                    BitBoard::Place(candidate.data(), size.Rows, size.Columns, pBlock->OriBitmaps[i % pBlock->OriCount],
+                        2 + (int)(i % (size.Columns - 4)), StackHeight(pf) + 1);
+                    BitBoard::ClearFullRows(candidate.data(), size.Rows, size.Columns);
+                    BitBoard::Compute(candidate.data(), size.Rows, size.Columns, features);
+                    acc += features.Holes;
+                }
+                g_Sink += acc;
+            });
+            g_Reporter.Add("Features.BitBoard", size, fill, m);
+        }
+    }
+
+    // The same queries as Playfield.PlacementTest and Playfield.GetCompletedRows on a FixedPlayfield
+    template <int Rows, int Cols>
+    void BenchFixed(const BoardSize& size, double fill)
+    {
+        // The larger instances do not fit on the stack comfortably
+        HeadlessHost host(1);
+        std::unique_ptr<FixedPlayfield<Rows, Cols> > owner(new FixedPlayfield<Rows, Cols>(&host));
+        FixedPlayfield<Rows, Cols>& pf = *owner;
+        FillBoard(pf, fill, 42);
+
+        BlockSet blocks;
+        HeadlessHost rng(7);
+
+        if (IsSelected("Fixed.PlacementTest"))
+        {
+            struct Query { const byte* Bitmap; int X; int Y; };
+            std::vector<Query> queries(QueryCount);
+            for (Query& q : queries)
+            {
+                Block* pBlock = blocks.Get(rng.Random(7));
+                q.Bitmap = pBlock->OriBitmaps[rng.Random(pBlock->OriCount)];
+                q.X = rng.Random(Cols);
+                q.Y = rng.Random(Rows);
+            }
+
+            Measurement m = MeasureBatch([&](long long n)
+            {
+                int acc = 0;
+                for (long long i = 0; i < n; i++)
+                {
+                    const Query& q = queries[i & (QueryCount - 1)];
+                    acc += pf.PlacementTest(q.Bitmap, q.X, q.Y);
+                }
+                g_Sink += acc;
+            });
+            g_Reporter.Add("Fixed.PlacementTest", size, fill, m);
+        }
+
+        if (IsSelected("Fixed.GetCompletedRows"))
+        {
+            Measurement m = MeasureBatch([&](long long n)
+            {
+                int acc = 0;
+                for (long long i = 0; i < n; i++)
+                    acc += pf.GetCompletedRows();
+                g_Sink += acc;
+            });
+            g_Reporter.Add("Fixed.GetCompletedRows", size, fill, m);
+        }
+    }
+
+    // FixedPlayfield is compiled for the board sizes up to 100x1000, the widest one has two words per row
+    void BenchFixedSizes(const BoardSize& size, double fill)
+    {
+        if (size.Columns == 10 && size.Rows == 20)
+            BenchFixed<20, 10>(size, fill);
+        else if (size.Columns == 40 && size.Rows == 100)
+            BenchFixed<100, 40>(size, fill);
+        else if (size.Columns == 100 && size.Rows == 1000)
+            BenchFixed<1000, 100>(size, fill);
+    }
+
+    void BenchGames(const BoardSize& size)
+    {
+        if (!IsSelected("Tetris.Game"))
+            return;
+
+        HeadlessHost host(5);
+        HeadlessHost policy(11);
+        Tetris tetris(&host, size.Rows, size.Columns);
+        uint64_t seed = 100;
+        int pieceLimit = size.Rows * size.Columns > 100000 ? LargeGamePieceLimit : GamePieceLimit;
+
+        // Random policy: random rotation and horizontal shift, then drop
+        Measurement m = MeasureEach(
+            [&]()
+            {
+                host.Seed(seed++);
+                tetris.Start();
+            },
+            [&]()
+            {
+                int pieces = 0;
+                while (!tetris.GetGameOver() && pieces < pieceLimit)
+                {
+                    for (int r = policy.Random(4); r > 0; r--)
+                        tetris.Rotate();
+
+                    int shift = policy.Random(size.Columns) - size.Columns / 2;
+                    for (; shift < 0; shift++)
+                        tetris.MoveLeft();
+                    for (; shift > 0; shift--)
+                        tetris.MoveRight();
+
+                    tetris.Drop();
+                    pieces++;
+                }
+                return (double)pieces;
+            });
+        g_Reporter.Add("Tetris.Game", size, 0.0, m, "pieces");
+    }
+
+    // Random games with the tetromino and the pentomino sets on the boards of up to 64 columns
+    void BenchPolyominoGames(const BoardSize& size)
+    {
+        if (size.Columns > PolyominoBoard::MaxColumns)
+            return;
+
+        struct Set { const char* Name; PieceSet Pieces; };
+        const Set sets[] =
+        {
+            { "Polyomino.Tetrominoes", PieceSet::Tetrominoes() },
+            { "Polyomino.Pentominoes", PieceSet::Pentominoes(true) },
+        };
+
+        for (const Set& set : sets)
+        {
+            if (!IsSelected(set.Name))
+                continue;
+
+            HeadlessHost policy(11);
+            uint64_t seed = 100;
+            std::unique_ptr<PolyominoGame> game;
+
+            Measurement m = MeasureEach(
+                [&]()
+                {
+                    game.reset(new PolyominoGame(set.Pieces, size.Rows, size.Columns, seed++));
+                    game->Start();
+                },
+                [&]()
+                {
+                    int pieces = 0;
+                    while (!game->GetGameOver() && pieces < GamePieceLimit)
+                    {
+                        for (int r = policy.Random(4); r > 0; r--)
+                            game->Rotate();
+
+                        int shift = policy.Random(size.Columns) - size.Columns / 2;
+                        for (; shift < 0; shift++)
+                            game->MoveLeft();
+                        for (; shift > 0; shift--)
+                            game->MoveRight();
+
+                        game->Drop();
+                        pieces++;
+                    }
+                    return (double)pieces;
+                });
+            g_Reporter.Add(set.Name, size, 0.0, m, "pieces");
+        }
+    }
+
+    // Inserting a garbage row below the stack and removing the bottom row of a VersusPlayfield, which move row
+    // pointers instead of cells
+    void BenchVersusPlayfield(const BoardSize& size, double fill)
+    {
+        HeadlessHost host(1);
+        VersusPlayfield pf(&host, size.Rows, size.Columns);
+        FillBoard(pf, fill, 42);
+        HeadlessHost rng(7);
+        int top = StackHeight(pf) - 1;
+
+        if (IsSelected("Versus.InsertGarbage"))
+        {
+            // The stack height is kept constant by removing its top row before every insertion
+            Measurement m = MeasureEach(
+                [&]() { pf.ClearRow(top); },
+                [&]() { pf.InsertGarbageRow(rng.Random(size.Columns), 8); return 1.0; });
+            g_Reporter.Add("Versus.InsertGarbage", size, fill, m);
+        }
+
+        // An empty board has no row to clear, as in Playfield.ClearRow
+        if (IsSelected("Versus.ClearRow") && fill > 0)
+        {
+            Measurement m = MeasureEach(
+                [&]() { FillRow(pf, top, fill, rng); },
+                [&]() { pf.ClearRow(0); return 1.0; });
+            g_Reporter.Add("Versus.ClearRow", size, fill, m);
+        }
+    }
+
+    int EvaluateVersusPlacement(const VersusTetris& game, int clearedRows)
+    {
+        const Playfield& pf = game.GetPlayfield();
+        int holes = 0;
+
+        for (int x = 0; x < pf.GetColumns(); x++)
+        {
+            bool covered = false;
+            for (int y = pf.GetHeight() - 1; y >= 0; y--)
+            {
+                if (pf.GetCell(x, y) != 0)
+                    covered = true;
+                else if (covered)
+                    holes++;
+            }
+        }
+
+        return clearedRows * clearedRows * 10 - pf.GetHeight() * 2 - holes * 8 - (game.GetGameOver() ? 1000 : 0);
+    }
+
+    // Plays the block with the best rotation and shift, tried one by one on a copy of the game
+    void PlayVersusGreedy(VersusTetris& player, VersusTetris& probe)
+    {
+        int cols = player.GetPlayfield().GetColumns();
+        int bestScore = 0;
+        int bestRotation = -1;
+        int bestShift = 0;
+
+        for (int r = 0; r < 4; r++)
+        {
+            for (int shift = -cols / 2; shift <= cols / 2; shift++)
+            {
+                probe.CopyState(player);
+                int cleared = probe.GetVersusPlayfield().GetClearedRows();
+
+                for (int i = 0; i < r; i++)
+                    probe.Rotate();
+                for (int i = shift; i < 0; i++)
+                    probe.MoveLeft();
+                for (int i = shift; i > 0; i--)
+                    probe.MoveRight();
+                probe.Drop();
+
+                int score = EvaluateVersusPlacement(probe, probe.GetVersusPlayfield().GetClearedRows() - cleared);
+                if (bestRotation < 0 || score > bestScore)
+                {
+                    bestScore = score;
+                    bestRotation = r;
+                    bestShift = shift;
+                }
+            }
+        }
+
+        for (int i = 0; i < bestRotation; i++)
+            player.Rotate();
+        for (int i = bestShift; i < 0; i++)
+            player.MoveLeft();
+        for (int i = bestShift; i > 0; i--)
+            player.MoveRight();
+        player.Drop();
+    }
+
+    // Headless matches of two greedy players, which clear enough rows to exchange garbage. The placement search is
+    // part of the measurement, so it runs only on the smallest board.
+    void BenchVersusMatches(const BoardSize& size)
+    {
+        if (!IsSelected("Versus.Match") || size.Rows * size.Columns > 1000)
+            return;
+
+        HeadlessHost host1(1);
+        HeadlessHost host2(2);
+        HeadlessHost probeHost(3);
+        VersusMatch match(&host1, &host2, size.Rows, size.Columns);
+        VersusTetris probe(&probeHost, size.Rows, size.Columns);
+        uint64_t seed = 100;
+
+        Measurement m = MeasureEach(
+            [&]()
+            {
+                host1.Seed(seed++);
+                host2.Seed(seed++);
+                match.Seed(seed);
+                match.Start();
+            },
+            [&]()
+            {
+                int pieces = 0;
+                while (!match.IsOver() && pieces < GamePieceLimit)
+                {
+                    PlayVersusGreedy(match.GetPlayer(pieces & 1), probe);
+                    pieces++;
+                }
+                return (double)pieces;
+            });
+        g_Reporter.Add("Versus.Match", size, 0.0, m, "pieces");
+    }
+
+    // One random action of a spectated game per frame
+    void PlaySpectatorFrame(SpectatorTetris& game, HeadlessHost& policy)
+    {
+        switch (policy.Random(8))
+        {
+        case 0: game.MoveLeft(); break;
+        case 1: game.MoveRight(); break;
+        case 2: game.Rotate(); break;
+        case 3: game.Drop(); break;
+        default: game.Run(); break;
+        }
+    }
+
+    // Encoding a frame per action of a random game, and broadcasting the recorded stream of a game to many
+    // in-process subscribers which decode every packet
+    void BenchSpectator(const BoardSize& size)
+    {
+        if (size.Rows * size.Columns > 100000)
+            return;
+
+        const int frameLimit = 2000;
+        const int subscriberCount = 1000;
+        HeadlessHost host(5);
+        HeadlessHost policy(11);
+        SpectatorTetris game(&host, size.Rows, size.Columns);
+
+        if (IsSelected("Spectator.Encode"))
+        {
+            uint64_t seed = 100;
+
+            Measurement m = MeasureEach(
+                [&]()
+                {
+                    host.Seed(seed++);
+                    game.Start();
+                },
+                [&]()
+                {
+                    int frames = 0;
+                    size_t bytes = 0;
+                    for (; frames < frameLimit && !game.GetGameOver(); frames++)
+                    {
+                        PlaySpectatorFrame(game, policy);
+                        SpectatorPacket packet = game.EncodeFrame();
+                        if (packet)
+                            bytes += packet->size();
+                    }
+                    g_Sink += (int)bytes;
+                    return (double)frames;
+                });
+            g_Reporter.Add("Spectator.Encode", size, 0.0, m, "frames");
+        }
+
+        // Every subscriber has a copy of the board, so the broadcast runs only on the smaller boards
+        if (IsSelected("Spectator.FanOut") && size.Rows * size.Columns <= 4000)
+        {
+            std::vector<SpectatorPacket> stream;
+            host.Seed(1);
+            game.Start();
+            for (int i = 0; i < frameLimit && !game.GetGameOver(); i++)
+            {
+                PlaySpectatorFrame(game, policy);
+                SpectatorPacket packet = game.EncodeFrame();
+                if (packet)
+                    stream.push_back(packet);
+            }
+
+            std::unique_ptr<SpectatorChannel> channel;
+            std::vector<SpectatorDecoder> subscribers;
+
+            Measurement m = MeasureEach(
+                [&]()
+                {
+                    channel.reset(new SpectatorChannel());
+                    subscribers.assign(subscriberCount, SpectatorDecoder());
+                    for (SpectatorDecoder& subscriber : subscribers)
+                        channel->Subscribe(&subscriber);
+                },
+                [&]()
+                {
+                    for (const SpectatorPacket& packet : stream)
+                        channel->Publish(packet);
+                    return (double)stream.size() * subscriberCount;
+                });
+            g_Reporter.Add("Spectator.FanOut", size, 0.0, m, "deliveries");
+        }
+    }
+
+    // Records a game at 60 frames per second: a gravity step every 8 frames and an occasional random action
+    void RecordReplayGame(ReplayRecorder& recorder, HeadlessHost& policy, uint64_t seed, unsigned long tickLimit)
+    {
+        recorder.Start(seed);
+        for (unsigned long tick = 0; tick < tickLimit && !recorder.GetGame().GetGameOver(); tick++)
+        {
+            byte input = (tick & 7) == 7 ? ReplayStep : 0;
+            switch (policy.Random(16))
+            {
+            case 0: input |= ReplayLeft; break;
+            case 1: input |= ReplayRight; break;
+            case 2: input |= ReplayRotate; break;
+            }
+            recorder.Apply(input);
+        }
+    }
+
+    // Seeking to random ticks of a recorded game, with the default checkpoint interval and without checkpoints.
+    // The games are replayed on a copy of the board, so only the smaller boards are measured.
+    void BenchReplay(const BoardSize& size)
+    {
+        if (size.Rows * size.Columns > 4000)
+            return;
+
+        const unsigned long tickLimit = 100000;
+        struct SeekCase { const char* Name; int CheckpointInterval; };
+        const SeekCase cases[] =
+        {
+            { "Replay.Seek", 600 },
+            { "Replay.SeekFromStart", 0 },
+        };
+
+        for (const SeekCase& c : cases)
+        {
+            if (!IsSelected(c.Name))
+                continue;
+
+            HeadlessHost policy(17);
+            ReplayRecorder recorder(size.Rows, size.Columns, c.CheckpointInterval);
+            RecordReplayGame(recorder, policy, 1, tickLimit);
+
+            const Replay& replay = recorder.GetReplay();
+            ReplayPlayer player(replay);
+            HeadlessHost rng(19);
+
+            Measurement m = MeasureBatch([&](long long n)
+            {
+                int acc = 0;
+                for (long long i = 0; i < n; i++)
+                {
+                    player.Seek((unsigned long)rng.Random((int)replay.GetTickCount() + 1));
+                    acc += player.GetGame().GetActualPoints();
+                }
+                g_Sink += acc;
+            });
+            g_Reporter.Add(c.Name, size, 0.0, m);
+        }
+    }
+
+    // The loop of GetCompletedRows before the row kernels, which skipped the last column
+    bool IsRowFullLegacy(const unsigned char* row, int cols)
+    {
+        for (int x = 0; x < cols - 1; x++)
+            if (row[x] == 0)
+                return false;
+
+        return true;
+    }
+
+    // Complete rows are the worst case of a full row test, every cell has to be read. They are reported with
+    // fill 1.
+    void BenchRowKernels(const BoardSize& size)
+    {
+        const int rowCount = 256;
+        std::vector<unsigned char> cells((size_t)rowCount * size.Columns);
+        HeadlessHost rng(11);
+        for (size_t i = 0; i < cells.size(); i++)
+            cells[i] = (unsigned char)(1 + rng.Random(7));
+
+        struct Kernel { const char* Name; RowKernel::IsRowFullFunction Function; };
+        const Kernel kernels[] =
+        {
+            { "RowKernel.Legacy", IsRowFullLegacy },
+            { "RowKernel.Scalar", RowKernel::IsRowFullScalar },
+            { "RowKernel.SSE2", RowKernel::IsSupported(RowKernelSse2) ? RowKernel::GetFunction(RowKernelSse2) : NULL },
+            { "RowKernel.AVX2", RowKernel::IsSupported(RowKernelAvx2) ? RowKernel::GetFunction(RowKernelAvx2) : NULL },
+        };
+
+        for (const Kernel& kernel : kernels)
+        {
+            if (kernel.Function == NULL || !IsSelected(kernel.Name))
+                continue;
+
+            Measurement m = MeasureBatch([&](long long n)
+            {
+                int acc = 0;
+                for (long long i = 0; i < n; i++)
+                    acc += kernel.Function(&cells[(size_t)(i & (rowCount - 1)) * size.Columns], size.Columns);
+                g_Sink += acc;
+            });
+            m.Work = (double)m.Iterations * size.Columns;
+            g_Reporter.Add(kernel.Name, size, 1.0, m, "cells");
+        }
+    }
+
+    void BenchRollouts(const BoardSize& size)
+    {
+        // The placement generator needs memory proportional to the board size
+        if (size.Rows * size.Columns > 100000)
+            return;
+
+        HeadlessHost host(13);
+        Tetris game(&host, size.Rows, size.Columns);
+        game.Start();
+
+        // Rollouts per second on one core, from the start of a game with random placements
+        if (IsSelected("MonteCarlo.Rollout"))
+        {
+            RolloutTetris rollout(size.Rows, size.Columns);
+            uint64_t seed = 1;
+
+            Measurement m = MeasureBatch([&](long long n)
+            {
+                int acc = 0;
+                for (long long i = 0; i < n; i++)
+                {
+                    rollout.Load(game, seed++);
+                    acc += rollout.Play(RolloutHorizon, RolloutRandom);
+                }
+                g_Sink += acc;
+            });
+            g_Reporter.Add("MonteCarlo.Rollout", size, 0.0, m);
+        }
+
+        // Evaluation of every placement of the first block on every hardware thread, only on the smaller boards
+        if (IsSelected("MonteCarlo.Evaluate") && size.Rows * size.Columns <= 4000)
+        {
+            RolloutTetris probe(size.Rows, size.Columns);
+            probe.Load(game, 1);
+            std::vector<Placement> candidates;
+            probe.GeneratePlacements(candidates);
+
+            RolloutOptions options;
+            options.Rollouts = RolloutsPerCandidate;
+            options.Horizon = RolloutHorizon;
+            MonteCarloEvaluator evaluator(options);
+            std::vector<RolloutResult> results;
+
+            Measurement m = MeasureEach(
+                [&]() { options.Seed++; evaluator.SetOptions(options); },
+                [&]()
+                {
+                    evaluator.Evaluate(game, candidates, results);
+                    return (double)(candidates.size() * RolloutsPerCandidate);
+                });
+            g_Reporter.Add("MonteCarlo.Evaluate", size, 0.0, m, "rollouts");
+        }
+    }
+
+    void ParseArguments(int argc, char** argv)
+    {
+        for (int i = 1; i < argc; i++)
+        {
+            if (strcmp(argv[i], "--quick") == 0)
+                g_Options.Quick = true;
+            else if (strncmp(argv[i], "--min-time=", 11) == 0)
+                g_Options.MinTime = atof(argv[i] + 11);
+            else if (strncmp(argv[i], "--filter=", 9) == 0)
+                g_Options.Filter = argv[i] + 9;
+            else
+            {
+                fprintf(stderr, "Usage: %s [--quick] [--min-time=<seconds>] [--filter=<text>]\n", argv[0]);
+                exit(1);
+            }
+        }
+
+        if (g_Options.Quick && g_Options.MinTime > 0.05)
+            g_Options.MinTime = 0.05;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    ParseArguments(argc, argv);
+
+    g_Reporter.Begin();
+
+    for (const BoardSize& size : BoardSizes)
+    {
+        if (g_Options.Quick && size.Rows * size.Columns > 100000)
+            continue;
+
+        for (double fill : FillDensities)
+        {
+            BenchPlayfield(size, fill);
+            BenchTetrisActions(size, fill);
+            BenchFeatures(size, fill);
+            BenchFixedSizes(size, fill);
+            BenchVersusPlayfield(size, fill);
+        }
+
+        BenchGames(size);
+        BenchPolyominoGames(size);
+        BenchVersusMatches(size);
+        BenchSpectator(size);
+        BenchReplay(size);
+        BenchRowKernels(size);
+        BenchRollouts(size);
+    }
+
+    g_Reporter.End();
+
+    return 0;
+}
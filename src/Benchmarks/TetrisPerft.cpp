@@ -0,0 +1,300 @@
+/*
+    Nanochord.Tetris
+
+    Perft: counts the distinct placement sequences of the first blocks of a game, to validate and time the move
+    generation and the collision code
+
+    MIT License - see Tetris.h for details.
+
+    Build from the repository root with any C++11 compiler, e.g.:
+        g++ -std=c++11 -O2 -pthread -I src/Cpp src/Benchmarks/TetrisPerft.cpp -o TetrisPerft
+
+    Usage:
+        TetrisPerft [--depth=<n>] [--seed=<n>] [--rows=<n>] [--columns=<n>] [--threads=<n>] [--backend=<name>]
+                    [--rotation=legacy|srs] [--divide]
+        TetrisPerft --verify [--threads=<n>]
+
+    The blocks come from a HeadlessHost with the specified seed, in the same order as in a game. A placement is a
+    distinct final pose of a block reachable with MoveLeft, MoveRight, Rotate and the gravity steps, so the count of
+    depth 1 is the number of places the first block can be locked at. The root placements are distributed among the
+    threads. --divide prints the count below every root placement, which helps to find where two backends differ.
+    --rotation selects the wall kicks (see TetrisRotation.h). --verify compares every backend with the known answers
+    of the reference Playfield.
+ */
+
+#include "Tetris.h"
+#include "TetrisPerft.h"
+#include "TetrisLarge.h"
+#include "TetrisFeatures.h"
+#include "TetrisFixed.h"
+#include "TetrisRotation.h"
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+using namespace Nanochord;
+
+namespace
+{
+    struct Options
+    {
+        int Depth = 3;
+        uint64_t Seed = 1;
+        int Rows = 20;
+        int Columns = 10;
+        int Threads = 0;            // 0 means the number of hardware threads
+        const char* Backend = "playfield";
+        const RotationSystem* Rotation = NULL;     // the rules of the original game
+        bool Divide = false;
+        bool Verify = false;
+    };
+
+    Options g_Options;
+    SrsRotationSystem g_Srs;
+
+    struct Result
+    {
+        uint64_t Count = 0;
+        uint64_t Nodes = 0;         // every generated placement, including the inner ones
+        double Seconds = 0;
+    };
+
+    /// <summary>
+    /// Known answer of the reference Playfield
+    /// </summary>
+    struct KnownAnswer
+    {
+        uint64_t Seed;
+        int Rows;
+        int Columns;
+        int Depth;
+        uint64_t Count;
+        bool Srs;
+    };
+
+    const KnownAnswer KnownAnswers[] =
+    {
+        { 1, 20, 10, 1, 34, false },
+        { 1, 20, 10, 2, 1182, false },
+        { 1, 20, 10, 3, 42352, false },
+        { 2, 20, 10, 3, 20345, false },
+        { 3, 20, 10, 3, 21073, false },
+        { 7, 12, 10, 4, 47090, false },
+        { 7, 10, 10, 4, 46841, false },
+        { 7, 10, 10, 5, 822754, false },      // a row completed in the last column, which GetCompletedRows used to skip
+        { 5, 16, 12, 3, 10065, false },
+        { 1, 20, 10, 3, 42419, true },
+        { 3, 10, 10, 3, 21162, true },
+        { 4, 10, 10, 3, 5610, true },
+    };
+
+    /// <summary>
+    /// FixedPlayfield with the constructor PerftSearch expects; the size arguments are the template arguments
+    /// </summary>
+    template <int Rows, int Cols>
+    class PerftFixedPlayfield : public FixedPlayfield<Rows, Cols>
+    {
+    public:
+        PerftFixedPlayfield(Host* pHost, int, int) : FixedPlayfield<Rows, Cols>(pHost)
+        {
+        }
+    };
+
+    int GetThreadCount()
+    {
+        if (g_Options.Threads > 0)
+            return g_Options.Threads;
+
+        unsigned cnt = std::thread::hardware_concurrency();
+        return cnt > 0 ? (int)cnt : 1;
+    }
+
+    template <class TPlayfield>
+    Result RunPerft(uint64_t seed, int rows, int cols, int depth, bool divide, const RotationSystem* pRotation)
+    {
+        Result result;
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+        PerftSearch<TPlayfield> rootSearch(seed, rows, cols, depth, pRotation);
+        std::vector<Placement> roots = rootSearch.GetRootPlacements();
+        std::vector<uint64_t> counts(roots.size(), 0);
+
+        std::atomic<size_t> nextRoot(0);
+        std::atomic<uint64_t> nodes(rootSearch.GetNodes());
+
+        // Every thread takes the next root placement until none is left
+        auto worker = [&]()
+        {
+            PerftSearch<TPlayfield> search(seed, rows, cols, depth, pRotation);
+            for (size_t i = nextRoot++; i < roots.size(); i = nextRoot++)
+                counts[i] = search.CountFrom(roots[i], depth);
+            nodes += search.GetNodes();
+        };
+
+        if (depth > 0)
+        {
+            std::vector<std::thread> threads;
+            for (int t = 1; t < GetThreadCount(); t++)
+                threads.push_back(std::thread(worker));
+            worker();
+            for (std::thread& thread : threads)
+                thread.join();
+
+            for (uint64_t cnt : counts)
+                result.Count += cnt;
+        }
+        else
+        {
+            result.Count = 1;
+        }
+
+        result.Nodes = nodes;
+        result.Seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        if (divide && depth > 0)
+        {
+            for (size_t i = 0; i < roots.size(); i++)
+                printf("  x=%d y=%d ori=%d: %llu\n", roots[i].X, roots[i].Y, roots[i].OriIndex, (unsigned long long)counts[i]);
+        }
+
+        return result;
+    }
+
+    // Runs the perft with a FixedPlayfield, which is compiled for the sizes of the known answers and the default
+    // size only. Returns false for other sizes.
+    bool RunFixed(uint64_t seed, int rows, int cols, int depth, bool divide, const RotationSystem* pRotation, Result& result)
+    {
+        if (rows == 20 && cols == 10)
+            result = RunPerft<PerftFixedPlayfield<20, 10> >(seed, rows, cols, depth, divide, pRotation);
+        else if (rows == 12 && cols == 10)
+            result = RunPerft<PerftFixedPlayfield<12, 10> >(seed, rows, cols, depth, divide, pRotation);
+        else if (rows == 10 && cols == 10)
+            result = RunPerft<PerftFixedPlayfield<10, 10> >(seed, rows, cols, depth, divide, pRotation);
+        else if (rows == 16 && cols == 12)
+            result = RunPerft<PerftFixedPlayfield<16, 12> >(seed, rows, cols, depth, divide, pRotation);
+        else
+            return false;
+
+        return true;
+    }
+
+    // Runs the perft with the specified collision backend. Returns false if the backend is unknown or does not
+    // support the size.
+    bool RunBackend(const char* backend, uint64_t seed, int rows, int cols, int depth, bool divide,
+        const RotationSystem* pRotation, Result& result)
+    {
+        if (strcmp(backend, "playfield") == 0)
+            result = RunPerft<Playfield>(seed, rows, cols, depth, divide, pRotation);
+        else if (strcmp(backend, "large") == 0)
+            result = RunPerft<LargePlayfield>(seed, rows, cols, depth, divide, pRotation);
+        else if (strcmp(backend, "features") == 0)
+            result = RunPerft<FeaturePlayfield>(seed, rows, cols, depth, divide, pRotation);
+        else if (strcmp(backend, "fixed") == 0)
+            return RunFixed(seed, rows, cols, depth, divide, pRotation, result);
+        else
+            return false;
+
+        return true;
+    }
+
+    const char* const Backends[] = { "playfield", "large", "features", "fixed" };
+
+    void PrintResult(const char* backend, uint64_t seed, int rows, int cols, int depth, bool srs, const Result& r)
+    {
+        printf("%s%s seed=%llu %dx%d depth=%d: %llu placement sequences, %llu nodes, %.3f s, %.0f nodes/s\n",
+            backend, srs ? " srs" : "", (unsigned long long)seed, cols, rows, depth, (unsigned long long)r.Count,
+            (unsigned long long)r.Nodes, r.Seconds, r.Seconds > 0 ? r.Nodes / r.Seconds : 0.0);
+    }
+
+    int Verify()
+    {
+        int failures = 0;
+
+        for (const KnownAnswer& answer : KnownAnswers)
+        {
+            for (const char* backend : Backends)
+            {
+                Result r;
+                const RotationSystem* pRotation = answer.Srs ? &g_Srs : NULL;
+                if (!RunBackend(backend, answer.Seed, answer.Rows, answer.Columns, answer.Depth, false, pRotation, r))
+                {
+                    printf("skip %s %dx%d\n", backend, answer.Columns, answer.Rows);
+                    continue;
+                }
+
+                bool ok = r.Count == answer.Count;
+                if (!ok)
+                    failures++;
+
+                printf("%s ", ok ? "ok  " : "FAIL");
+                PrintResult(backend, answer.Seed, answer.Rows, answer.Columns, answer.Depth, answer.Srs, r);
+                if (!ok)
+                    printf("     expected %llu\n", (unsigned long long)answer.Count);
+            }
+        }
+
+        printf("%d failure(s)\n", failures);
+        return failures == 0 ? 0 : 1;
+    }
+
+    void ParseArguments(int argc, char** argv)
+    {
+        for (int i = 1; i < argc; i++)
+        {
+            if (strncmp(argv[i], "--depth=", 8) == 0)
+                g_Options.Depth = atoi(argv[i] + 8);
+            else if (strncmp(argv[i], "--seed=", 7) == 0)
+                g_Options.Seed = strtoull(argv[i] + 7, NULL, 10);
+            else if (strncmp(argv[i], "--rows=", 7) == 0)
+                g_Options.Rows = atoi(argv[i] + 7);
+            else if (strncmp(argv[i], "--columns=", 10) == 0)
+                g_Options.Columns = atoi(argv[i] + 10);
+            else if (strncmp(argv[i], "--threads=", 10) == 0)
+                g_Options.Threads = atoi(argv[i] + 10);
+            else if (strncmp(argv[i], "--backend=", 10) == 0)
+                g_Options.Backend = argv[i] + 10;
+            else if (strcmp(argv[i], "--rotation=legacy") == 0)
+                g_Options.Rotation = NULL;
+            else if (strcmp(argv[i], "--rotation=srs") == 0)
+                g_Options.Rotation = &g_Srs;
+            else if (strcmp(argv[i], "--divide") == 0)
+                g_Options.Divide = true;
+            else if (strcmp(argv[i], "--verify") == 0)
+                g_Options.Verify = true;
+            else
+            {
+                fprintf(stderr, "Usage: %s [--depth=<n>] [--seed=<n>] [--rows=<n>] [--columns=<n>] [--threads=<n>] "
+                    "[--backend=playfield|large|features|fixed] [--rotation=legacy|srs] [--divide] [--verify]\n", argv[0]);
+                exit(1);
+            }
+        }
+    }
+}
+
+int main(int argc, char** argv)
+{
+    ParseArguments(argc, argv);
+
+    if (g_Options.Verify)
+        return Verify();
+
+    // Iterative deepening, like the usual perft output
+    for (int depth = 1; depth <= g_Options.Depth; depth++)
+    {
+        Result r;
+        bool divide = g_Options.Divide && depth == g_Options.Depth;
+        if (!RunBackend(g_Options.Backend, g_Options.Seed, g_Options.Rows, g_Options.Columns, depth, divide, g_Options.Rotation, r))
+        {
+            fprintf(stderr, "Unknown backend or unsupported size: %s\n", g_Options.Backend);
+            return 1;
+        }
+
+        PrintResult(g_Options.Backend, g_Options.Seed, g_Options.Rows, g_Options.Columns, depth, g_Options.Rotation != NULL, r);
+    }
+
+    return 0;
+}
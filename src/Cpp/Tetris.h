@@ -29,10 +29,35 @@
 #ifndef _Nanochord_Tetris_
 #define _Nanochord_Tetris_
 
+#include <stddef.h>
+
 #ifndef ARDUINO
 typedef unsigned char byte;
 #endif
 
+#ifdef TETRIS_INSTRUMENTATION
+#include "TetrisStats.h"
+#else
+#define TETRIS_STAT_INC(stats, counter)
+#define TETRIS_STAT_ADD(stats, counter, value)
+#define TETRIS_STAT_HOST_CALL(stats, kind)
+#define TETRIS_STAT_LATENCY(stats, histogram)
+#endif
+
+#ifdef TETRIS_TRACING
+#include "TetrisTrace.h"
+#else
+#define TETRIS_TRACE_SCOPE(name)
+#endif
+
+#ifdef TETRIS_SIMD
+#include "TetrisSimd.h"
+#endif
+
+#ifdef TETRIS_STATE_HASH
+#include "TetrisHash.h"
+#endif
+
 namespace Nanochord
 {
     class Playfield;
@@ -218,6 +243,77 @@ namespace Nanochord
         StickoutRight = 3,
     };
 
+    /// <summary>
+    /// When a wall kick is tried, depending on the result of the test of the rotation in place
+    /// </summary>
+    enum WallKickCondition
+    {
+        KickAlways,
+        KickIfStickoutLeft,
+        KickIfStickoutRight
+    };
+
+    /// <summary>
+    /// Offset of a block tried when it is rotated
+    /// </summary>
+    struct WallKick
+    {
+        signed char X;
+        signed char Y;          // positive is up
+        byte Condition;         // WallKickCondition
+    };
+
+    /// <summary>
+    /// Rotation rules: the kicks tried in order when a block is rotated from one orientation to another. The first
+    /// kick which does not collide is taken; the first kick of a table is normally the rotation in place.
+    /// This class implements the rules of the original game: a block which would stick out of the playfield is
+    /// kicked back from the wall by one column (an I block by two columns from the left wall). Derived classes can
+    /// provide other tables (see TetrisRotation.h).
+    /// </summary>
+    class RotationSystem
+    {
+    public:
+        RotationSystem()
+        {
+        }
+
+        virtual ~RotationSystem()
+        {
+        }
+
+        // Returns the number of kicks and the kicks of the specified rotation
+        virtual int GetKicks(const Block* pBlock, byte fromIndex, byte toIndex, const WallKick*& pKicks) const
+        {
+            static const WallKick kicks[] =
+            {
+                { 0, 0, KickAlways },
+                { 1, 0, KickIfStickoutLeft },
+                { 2, 0, KickIfStickoutLeft },       // I block only
+                { -1, 0, KickIfStickoutRight }
+            };
+            static const WallKick kicksNoI[] =
+            {
+                { 0, 0, KickAlways },
+                { 1, 0, KickIfStickoutLeft },
+                { -1, 0, KickIfStickoutRight }
+            };
+
+            pKicks = pBlock->IsI ? kicks : kicksNoI;
+            return pBlock->IsI ? 4 : 3;
+        }
+
+        // Returns the largest downward and upward offsets of the kicks, move generators need them
+        virtual int GetMaxKickDown() const { return 0; }
+        virtual int GetMaxKickUp() const { return 0; }
+
+        // Returns the rules of the original game
+        static const RotationSystem* GetDefault()
+        {
+            static const RotationSystem rotationSystem;
+            return &rotationSystem;
+        }
+    };
+
     /// <summary>
     /// Different kind of Tetris events
     /// </summary>
@@ -229,12 +325,278 @@ namespace Nanochord
         LevelChanged
     };
 
+    /// <summary>
+    /// Cell of the playfield
+    /// </summary>
+    struct BlockCell
+    {
+        int X;
+        int Y;
+    };
+
+    /// <summary>
+    /// Movement of a block: its old and new pose, and the cells which have to be erased and painted on the output.
+    /// Cells covered by both poses and cells outside the playfield are not listed.
+    /// </summary>
+    struct BlockMove
+    {
+        int OldX;
+        int OldY;
+        byte OldOriIndex;
+        int NewX;
+        int NewY;
+        byte NewOriIndex;
+
+        byte EraseCount;
+        BlockCell Erase[4];
+        byte PaintCount;
+        BlockCell Paint[4];
+
+        // Calculates the move of the specified block from its current pose to the specified one
+        void Set(const Block* pBlock, int x, int y, byte oriIndex, int rows, int cols)
+        {
+            OldX = pBlock->X;
+            OldY = pBlock->Y;
+            OldOriIndex = pBlock->OriIndex;
+            NewX = x;
+            NewY = y;
+            NewOriIndex = oriIndex;
+
+            EraseCount = GetCells(pBlock->OriBitmaps[OldOriIndex], OldX, OldY, pBlock->OriBitmaps[NewOriIndex], NewX, NewY, rows, cols, Erase);
+            PaintCount = GetCells(pBlock->OriBitmaps[NewOriIndex], NewX, NewY, pBlock->OriBitmaps[OldOriIndex], OldX, OldY, rows, cols, Paint);
+        }
+
+    protected:
+        // Collects the cells of the first bitmap which are inside the playfield and not covered by the second bitmap
+        static byte GetCells(const byte* bitmap, int x, int y, const byte* other, int otherX, int otherY, int rows, int cols, BlockCell* cells)
+        {
+            byte cnt = 0;
+
+            for (int i = 0; i < 4; i++)
+            {
+                int yy = y + 1 - i;
+                if (bitmap[i] == 0 || yy < 0 || yy >= rows)
+                    continue;
+
+                // Row of the other bitmap at the same height, shifted to the columns of this one
+                int oi = otherY + 1 - yy;
+                int otherRow = 0;
+                int shift = otherX - x;
+                if (oi >= 0 && oi < 4 && shift > -4 && shift < 4)
+                {
+                    otherRow = other[oi];
+                    otherRow = shift >= 0 ? otherRow >> shift : otherRow << -shift;
+                }
+
+                for (int k = 0; k < 4; k++)
+                {
+                    int mask = 0x8 >> k;
+                    int xx = x - 2 + k;
+
+                    if ((bitmap[i] & mask) != 0 && (otherRow & mask) == 0 && xx >= 0 && xx < cols)
+                    {
+                        cells[cnt].X = xx;
+                        cells[cnt].Y = yy;
+                        cnt++;
+                    }
+                }
+            }
+
+            return cnt;
+        }
+    };
+
+    /// <summary>
+    /// Kinds of recorded render commands
+    /// </summary>
+    enum RenderCommandKind
+    {
+        RenderClearBackground,
+        RenderFillCell,         // sets the cell (X, Y) of the playfield to Color, 0 means empty
+        RenderNextBlock,        // displays Bitmap with Color as the next block
+        RenderPaintRows         // displays the rows [Y, Y + Count) from the current content of the playfield
+    };
+
+    /// <summary>
+    /// Recorded render command
+    /// </summary>
+    struct RenderCommand
+    {
+        RenderCommandKind Kind;
+        int X;
+        int Y;
+        int Count;
+        byte Color;
+        byte Bitmap[4];
+    };
+
+    /// <summary>
+    /// Preallocated list of render commands, which Tetris fills instead of calling the Host drawing functions
+    /// </summary>
+    class RenderCommandBuffer
+    {
+    public:
+        RenderCommandBuffer(int capacity)
+        {
+            m_Capacity = capacity > 16 ? capacity : 16;
+            m_Count = 0;
+            m_pCommands = new RenderCommand[m_Capacity];
+        }
+
+        ~RenderCommandBuffer()
+        {
+            delete[] m_pCommands;
+        }
+
+        int GetCount() const { return m_Count; }
+        int GetCapacity() const { return m_Capacity; }
+        bool IsFull() const { return m_Count >= m_Capacity; }
+        const RenderCommand& GetCommand(int index) const { return m_pCommands[index]; }
+
+        void Clear() { m_Count = 0; }
+
+        // Appends a new command, the buffer must not be full
+        RenderCommand& Add(RenderCommandKind kind)
+        {
+            RenderCommand& cmd = m_pCommands[m_Count++];
+            cmd.Kind = kind;
+            return cmd;
+        }
+
+    protected:
+        RenderCommand* m_pCommands;
+        int m_Capacity;
+        int m_Count;
+    };
+
+    /// <summary>
+    /// Composited view of the game: the playfield with the current block drawn over it, and the next block.
+    /// Every change stamps the changed row with a new version, so a reader which remembers the last version it has
+    /// seen can skip the unchanged rows. It is updated on the game thread; other threads should use SnapshotTetris.
+    /// </summary>
+    class Framebuffer
+    {
+        friend class Tetris;
+
+    public:
+        Framebuffer()
+        {
+            m_Rows = 0;
+            m_Columns = 0;
+            m_Version = 0;
+            m_NextVersion = 0;
+            m_NextColor = 0;
+            m_pCells = NULL;
+            m_pRowVersions = NULL;
+
+            for (int i = 0; i < 4; i++)
+                m_NextBitmap[i] = 0;
+        }
+
+        ~Framebuffer()
+        {
+            delete[] m_pCells;
+            delete[] m_pRowVersions;
+        }
+
+        int GetRows() const { return m_Rows; }
+        int GetColumns() const { return m_Columns; }
+
+        // Row-major cells, row 0 is the bottom row, 0 means empty
+        const byte* GetCells() const { return m_pCells; }
+        byte GetCell(int x, int y) const { return m_pCells[y * m_Columns + x]; }
+
+        // The version of the last change of the whole view and of the specified row
+        unsigned long GetVersion() const { return m_Version; }
+        unsigned long GetRowVersion(int y) const { return m_pRowVersions[y]; }
+
+        // The next block
+        const byte* GetNextBitmap() const { return m_NextBitmap; }
+        byte GetNextColor() const { return m_NextColor; }
+        unsigned long GetNextVersion() const { return m_NextVersion; }
+
+    protected:
+        int m_Rows;
+        int m_Columns;
+        byte* m_pCells;
+        unsigned long* m_pRowVersions;
+        unsigned long m_Version;
+        byte m_NextBitmap[4];
+        byte m_NextColor;
+        unsigned long m_NextVersion;
+
+        void Init(int rows, int cols)
+        {
+            if (rows != m_Rows || cols != m_Columns)
+            {
+                delete[] m_pCells;
+                delete[] m_pRowVersions;
+
+                m_Rows = rows;
+                m_Columns = cols;
+                m_pCells = new byte[rows * cols];
+                m_pRowVersions = new unsigned long[rows];
+            }
+
+            Clear();
+        }
+
+        void Clear()
+        {
+            m_Version++;
+            for (int y = 0; y < m_Rows; y++)
+            {
+                for (int x = 0; x < m_Columns; x++)
+                    m_pCells[y * m_Columns + x] = 0;
+                m_pRowVersions[y] = m_Version;
+            }
+        }
+
+        void SetCell(int x, int y, byte color)
+        {
+            if (x < 0 || x >= m_Columns || y < 0 || y >= m_Rows)
+                return;
+
+            byte& cell = m_pCells[y * m_Columns + x];
+            if (cell != color)
+            {
+                cell = color;
+                m_pRowVersions[y] = ++m_Version;
+            }
+        }
+
+        void SetBlock(const Block* pBlock, byte color)
+        {
+            const byte* bmp = pBlock->GetCurrentBitmap();
+
+            for (int i = 0; i < 4; i++)
+                for (int k = 0; k < 4; k++)
+                    if ((bmp[i] & (0x8 >> k)) != 0)
+                        SetCell(pBlock->X - 2 + k, pBlock->Y + 1 - i, color);
+        }
+
+        // Copies the rows [fromRow, toRow) of the playfield. It is defined after the Playfield class.
+        void SetRows(const Playfield* pPlayfield, int fromRow, int toRow);
+
+        void SetNextBlock(const Block* pBlock)
+        {
+            const byte* bmp = pBlock->GetCurrentBitmap();
+
+            for (int i = 0; i < 4; i++)
+                m_NextBitmap[i] = bmp[i];
+            m_NextColor = pBlock->Color;
+            m_NextVersion = ++m_Version;
+        }
+    };
+
     /// <summary>
     /// Abstract class, interface to the embedder environment
     /// </summary>
     class Host
     {
     public:
+        virtual ~Host() {}
+
         // Clears the entire background
         virtual void ClearBackground() = 0;
 
@@ -247,9 +609,31 @@ namespace Nanochord
         // Clears the specified block from the output
         virtual void ClearBlock(const Block* Block) = 0;
 
+        // Displays the movement of the specified block, which is already at its new pose, by erasing and painting only
+        // the cells listed in the move. Hosts which return false (the default) get a ClearBlock call for the old pose
+        // and a DrawBlock call for the new one instead.
+        virtual bool MoveBlock(const Block* Block, const BlockMove* Move)
+        {
+            return false;
+        }
+
         // Displays the current content of the playfield
         virtual void PaintPlayground(const Playfield* Playfield) = 0;
 
+        // Displays the rows [fromRow, toRow) of the playfield, the only ones which changed since the last repaint.
+        // Hosts which can redraw a part of the playfield should override it, by default the whole playfield is painted.
+        virtual void PaintRows(const Playfield* Playfield, int fromRow, int toRow)
+        {
+            PaintPlayground(Playfield);
+        }
+
+        // Displays the commands recorded since the last flush, when the game records its output into a command buffer
+        // (see Tetris::SetCommandBuffer). The commands have to be applied in order; PaintRows reads the playfield as it
+        // is at the time of the flush. Hosts which use a command buffer have to override it.
+        virtual void ExecuteCommands(const Playfield* Playfield, const RenderCommandBuffer* Commands)
+        {
+        }
+
         // Prints to the console output the specified text (for debug purposes)
         virtual void Print(const char* text) = 0;
 
@@ -271,39 +655,172 @@ namespace Nanochord
     public:
         Playfield(Host* pHost, int rows, int cols)
         {
-            m_pHost = pHost;
-            m_Rows = rows;
-            m_Columns = cols;
-
-            // Minimum 10x10!
-            if (m_Rows < 10)
-                m_Rows = 10;
-            if (m_Columns < 10)
-                m_Columns = 10;
+            Init(pHost, rows, cols);
 
             Map = new byte*[m_Rows];
             for (int r = 0; r < m_Rows; r++)
                 Map[r] = new byte[m_Columns];
+            TETRIS_STAT_ADD(Stats, Allocations, m_Rows + 1);
+            m_OwnsMap = true;
 
+            // The new rows are uninitialized, all of them have to be cleared
+            m_Height = m_Rows;
             Clear();
         }
 
-        ~Playfield()
+        virtual ~Playfield()
         {
-            for (int r = 0; r < m_Rows; r++)
-                delete[] Map[r];
-            delete[] Map;
+            if (m_OwnsMap)
+            {
+                for (int r = 0; r < m_Rows; r++)
+                    delete[] Map[r];
+                delete[] Map;
+            }
         }
 
         byte **Map;
         int CompletedLines[4] = { 0 };
 
+#ifdef TETRIS_INSTRUMENTATION
+        TetrisStats Stats;
+#endif
+
     protected:
         int m_Columns;
         int m_Rows;
         Host* m_pHost;
+        bool m_OwnsMap;
+        int m_Height;           // rows at and above this one are empty
+        int m_DamageFrom;       // rows [m_DamageFrom, m_DamageTo) changed since the last ResetDamage call
+        int m_DamageTo;
+        const RotationSystem* m_pRotationSystem;
+
+        // Constructor for derived classes with their own storage. The specified row table is used as Map but it is
+        // not freed. If it is NULL, the derived class has to override every function which accesses Map.
+        Playfield(Host* pHost, int rows, int cols, byte** map)
+        {
+            Init(pHost, rows, cols);
+            Map = map;
+            m_OwnsMap = false;
+        }
+
+        void Init(Host* pHost, int rows, int cols)
+        {
+            m_pHost = pHost;
+            m_Rows = rows;
+            m_Columns = cols;
+
+            // Minimum 10x10!
+            if (m_Rows < 10)
+                m_Rows = 10;
+            if (m_Columns < 10)
+                m_Columns = 10;
+
+            m_Height = 0;
+            m_DamageFrom = 0;
+            m_DamageTo = 0;
+            m_pRotationSystem = RotationSystem::GetDefault();
+        }
+
+        // Adds the rows [from, to) to the damaged rows
+        void AddDamage(int from, int to)
+        {
+            if (from >= to)
+                return;
+
+            if (m_DamageFrom >= m_DamageTo)
+            {
+                m_DamageFrom = from;
+                m_DamageTo = to;
+                return;
+            }
+
+            if (from < m_DamageFrom)
+                m_DamageFrom = from;
+            if (to > m_DamageTo)
+                m_DamageTo = to;
+        }
 
     public:
+        int GetRows() const { return m_Rows; }
+        int GetColumns() const { return m_Columns; }
+
+        // Returns the height of the stack: the rows at and above this one are all empty
+        int GetHeight() const { return m_Height; }
+
+        // Returns the damaged rows [GetDamageFrom(), GetDamageTo()): the ones which changed since the last
+        // ResetDamage call
+        bool HasDamage() const { return m_DamageFrom < m_DamageTo; }
+        int GetDamageFrom() const { return m_DamageFrom; }
+        int GetDamageTo() const { return m_DamageTo; }
+
+        // Sets the rotation rules, which must outlive the playfield. NULL restores the rules of the original game.
+        void SetRotationSystem(const RotationSystem* pRotationSystem)
+        {
+            m_pRotationSystem = pRotationSystem != NULL ? pRotationSystem : RotationSystem::GetDefault();
+        }
+
+        const RotationSystem* GetRotationSystem() const { return m_pRotationSystem; }
+
+        // Marks every row as displayed
+        void ResetDamage()
+        {
+            m_DamageFrom = 0;
+            m_DamageTo = 0;
+        }
+
+        // Finds the stack height again. It has to be called after writing Map directly.
+        void RecalculateHeight()
+        {
+            int height = m_Rows;
+            while (height > 0 && IsRowEmpty(height - 1))
+                height--;
+
+            AddDamage(0, height > m_Height ? height : m_Height);
+            m_Height = height;
+        }
+
+        // Returns the color of the specified cell, 0 means empty. Hosts should use this instead of Map to support
+        // every kind of playfield.
+        virtual byte GetCell(int x, int y) const
+        {
+            return Map[y][x];
+        }
+
+        // Sets the color of the specified cell, 0 means empty
+        virtual void SetCell(int x, int y, byte color)
+        {
+            Map[y][x] = color;
+            AddDamage(y, y + 1);
+
+            if (color != 0 && y >= m_Height)
+                m_Height = y + 1;
+        }
+
+        // Tells whether the specified row is completely empty
+        virtual bool IsRowEmpty(int y) const
+        {
+            for (int x = 0; x < m_Columns; x++)
+                if (Map[y][x] != 0)
+                    return false;
+
+            return true;
+        }
+
+        // Tells whether every cell of the specified row is occupied
+        virtual bool IsRowFull(int y) const
+        {
+#ifdef TETRIS_SIMD
+            return RowKernel::IsRowFull(Map[y], m_Columns);
+#else
+            for (int x = 0; x < m_Columns; x++)
+                if (Map[y][x] == 0)
+                    return false;
+
+            return true;
+#endif
+        }
+
         // Tests whether the specified 4x4 bitmap can be placed at the specified position without overlapping other blocks or
         // hanging out of the playfield
         virtual PlacementTestResult PlacementTest(const byte* bitmap, int x, int y)
@@ -311,6 +828,8 @@ namespace Nanochord
             if (bitmap == NULL)
                 return PlacementTestResult::Error;
 
+            TETRIS_STAT_INC(Stats, PlacementTests);
+
             int yy = 0;
             PlacementTestResult res = PlacementTestResult::Succeeded;
 
@@ -347,17 +866,58 @@ namespace Nanochord
             return PlacementTestResult::Succeeded;
         }
 
+        // Tests whether the specified block can be turned from one orientation into another at the specified position
+        // with the kicks of the rotation system. Returns false if it cannot be rotated, otherwise newX and newY are
+        // the position of the block after the kick. The game and the move generators share these rules.
+        bool RotationTest(const Block* pBlock, byte fromIndex, byte toIndex, int x, int y, int& newX, int& newY)
+        {
+            const byte* bmp = pBlock->OriBitmaps[toIndex];
+            const WallKick* pKicks = NULL;
+            int cnt = m_pRotationSystem->GetKicks(pBlock, fromIndex, toIndex, pKicks);
+            PlacementTestResult inPlace = PlacementTestResult::Succeeded;
+
+            for (int i = 0; i < cnt; i++)
+            {
+                const WallKick& kick = pKicks[i];
+                if (i > 0 && !(kick.Condition == KickAlways ||
+                    (kick.Condition == KickIfStickoutLeft && inPlace == PlacementTestResult::StickoutLeft) ||
+                    (kick.Condition == KickIfStickoutRight && inPlace == PlacementTestResult::StickoutRight)))
+                {
+                    continue;
+                }
+
+                PlacementTestResult res = PlacementTest(bmp, x + kick.X, y + kick.Y);
+                if (res == PlacementTestResult::Succeeded)
+                {
+                    newX = x + kick.X;
+                    newY = y + kick.Y;
+                    return true;
+                }
+
+                if (i == 0)
+                    inPlace = res;
+            }
+
+            return false;
+        }
+
         // Ocupies the area represented by the specified block in the playfield
         virtual void Occupy(const Block* pBlock)
         {
             const byte* currBmp = pBlock->GetCurrentBitmap();
 
-            for (byte i = 0; i < 4; i++)
+            TETRIS_STAT_INC(Stats, Locks);
+
+            for (int i = 0; i < 4; i++)
             {
-                byte yy = pBlock->Y + 1 - i;
+                int yy = pBlock->Y + 1 - i;
 
-                if (yy < m_Rows)
+                if (yy >= 0 && yy < m_Rows && currBmp[i] != 0)
                 {
+                    if (yy >= m_Height)
+                        m_Height = yy + 1;
+                    AddDamage(yy, yy + 1);
+
                     if ((currBmp[i] & 0x8) != 0)
                         Map[yy][pBlock->X - 2] = pBlock->Color;
 
@@ -376,23 +936,13 @@ namespace Nanochord
         // Returns the number of completed rows in the playfield
         virtual int GetCompletedRows()
         {
+            TETRIS_TRACE_SCOPE("GetCompletedRows");
+
             int cnt = 0;
 
-            for (int y = m_Rows - 1; y >= 0; y--)
+            for (int y = m_Height - 1; y >= 0 && cnt < 4; y--)
             {
-                bool isRowFull = true;
-
-                for (int x = 0; x < m_Columns - 1; x++)
-                {
-
-                    if (Map[y][x] == 0)
-                    {
-                        isRowFull = false;
-                        break;
-                    }
-                }
-
-                if (isRowFull)
+                if (IsRowFull(y))
                 {
                     CompletedLines[cnt] = y;
                     cnt++;
@@ -402,23 +952,63 @@ namespace Nanochord
             return cnt;
         }
 
+        // Copies the cells of the specified playfield of the same size into this one
+        virtual void CopyFrom(const Playfield& other)
+        {
+            int height = m_Height > other.m_Height ? m_Height : other.m_Height;
+
+            for (int y = 0; y < height; y++)
+            {
+                if (y >= other.m_Height)
+                {
+                    for (int x = 0; x < m_Columns; x++)
+                        Map[y][x] = 0;
+                }
+                else if (other.Map != NULL)
+                {
+                    for (int x = 0; x < m_Columns; x++)
+                        Map[y][x] = other.Map[y][x];
+                }
+                else
+                {
+                    for (int x = 0; x < m_Columns; x++)
+                        Map[y][x] = other.GetCell(x, y);
+                }
+            }
+
+            AddDamage(0, height);
+            m_Height = other.m_Height;
+        }
+
         // Empties the playfield
         virtual void Clear()
         {
-            for (byte i = 0; i < m_Rows; i++)
-                for (byte j = 0; j < m_Columns; j++)
+            for (int i = 0; i < m_Height; i++)
+                for (int j = 0; j < m_Columns; j++)
                     Map[i][j] = 0;
+
+            AddDamage(0, m_Height);
+            m_Height = 0;
         }
 
         // Empties the specified row in the playfield
-        virtual void ClearRow(byte y)
+        virtual void ClearRow(int y)
         {
-            for (byte i = y + 1; i < m_Rows; i++)
-                for (byte x = 0; x < m_Columns; x++)
+            TETRIS_STAT_INC(Stats, RowsCleared);
+
+            // Only the stack moves down, the rows above it are empty anyway
+            if (y >= m_Height)
+                return;
+
+            for (int i = y + 1; i < m_Height; i++)
+                for (int x = 0; x < m_Columns; x++)
                     Map[i - 1][x] = Map[i][x];
 
-            for (byte x = 0; x < m_Columns; x++)
-                Map[m_Rows - 1][x] = 0;
+            for (int x = 0; x < m_Columns; x++)
+                Map[m_Height - 1][x] = 0;
+
+            AddDamage(y, m_Height);
+            m_Height--;
         }
 
         // Dumps the content of the playfield
@@ -426,12 +1016,14 @@ namespace Nanochord
         {
             if (m_pHost != NULL)
             {
-                for (byte i = 0; i < m_Rows; i++)
+                for (int i = 0; i < m_Rows; i++)
                 {
-                    for (byte j = 0; j < m_Columns; j++)
+                    for (int j = 0; j < m_Columns; j++)
                     {
+                        TETRIS_STAT_HOST_CALL(Stats, CallPrint);
                         m_pHost->Print(Map[i][j] == 0 ? "0" : "1");
                     }
+                    TETRIS_STAT_HOST_CALL(Stats, CallPrint);
                     m_pHost->Print("\r\n");
                 }
             }
@@ -446,7 +1038,7 @@ namespace Nanochord
                 return PlacementTestResult::StickoutRight;
             if (yy < 0)
                 return PlacementTestResult::Failed;
-            if (yy > m_Rows - 1)
+            if (yy >= m_Height)
                 return PlacementTestResult::Succeeded;
 
             return Map[yy][xx] != 0 ? PlacementTestResult::Failed : PlacementTestResult::Succeeded;
@@ -454,19 +1046,40 @@ namespace Nanochord
     };
 
 
+    inline void Framebuffer::SetRows(const Playfield* pPlayfield, int fromRow, int toRow)
+    {
+        for (int y = fromRow; y < toRow && y < m_Rows; y++)
+            for (int x = 0; x < m_Columns; x++)
+                SetCell(x, y, pPlayfield->GetCell(x, y));
+    }
+
     /// <summary>
     /// This class implements the simple Tetris game logic.
     /// </summary>
     class Tetris
     {
     public:
-        Tetris(Host* pHost, int rows, int cols) : m_Playfield(pHost, rows, cols)
+        Tetris(Host* pHost, int rows, int cols) : m_pOwnedPlayfield(new Playfield(pHost, rows, cols)), m_Playfield(*m_pOwnedPlayfield)
         {
             m_pHost = pHost;
         }
 
+        // Plays on the specified playfield (e.g. a derived class with a different storage), which must outlive the game
+        Tetris(Host* pHost, Playfield* pPlayfield) : m_pOwnedPlayfield(NULL), m_Playfield(*pPlayfield)
+        {
+            m_pHost = pHost;
+        }
+
+        virtual ~Tetris()
+        {
+            delete m_pCurrentBlock;
+            delete m_pNextBlock;
+            delete m_pOwnedPlayfield;
+        }
+
     protected:
-        Playfield m_Playfield;
+        Playfield* m_pOwnedPlayfield;
+        Playfield& m_Playfield;
         Block* m_pCurrentBlock = NULL;
         Block* m_pNextBlock = NULL;
         byte m_ActualLevel = 1;
@@ -475,6 +1088,12 @@ namespace Nanochord
         bool m_IsPaused = false;
         bool m_GameOver = false;
         Host* m_pHost;
+        RenderCommandBuffer* m_pCommands = NULL;
+        Framebuffer* m_pFramebuffer = NULL;
+#ifdef TETRIS_STATE_HASH
+        BoardHash m_BoardHash;
+        uint64_t m_RandomHash = 0;      // chain of the random numbers drawn from the host
+#endif
 
     public:
         // Starts a new game
@@ -483,9 +1102,17 @@ namespace Nanochord
             if (m_pHost == NULL)
                 return -1;
 
-            m_pHost->ClearBackground();
+            HostClearBackground();
 
             m_Playfield.Clear();
+            m_Playfield.ResetDamage();
+#ifdef TETRIS_STATE_HASH
+            m_BoardHash.Init(m_Playfield.m_Rows);
+            m_RandomHash = 0;
+#endif
+
+            delete m_pCurrentBlock;
+            delete m_pNextBlock;
 
             m_ActualLevel = 1;
             m_ActualPoints = 0;
@@ -496,8 +1123,8 @@ namespace Nanochord
             m_pCurrentBlock = CreateNewRandomBlock();
             m_pNextBlock = CreateNewRandomBlock();
 
-            m_pHost->DrawBlock(m_pCurrentBlock);
-            m_pHost->DrawNextBlock(m_pNextBlock);
+            HostDrawBlock(m_pCurrentBlock);
+            HostDrawNextBlock(m_pNextBlock);
 
             return m_ActualLevel;
         }
@@ -507,6 +1134,130 @@ namespace Nanochord
         int GetLinesCompleted() const { return m_LinesCompleted; }
         bool GetIsPaused() const { return m_IsPaused; }
         bool GetGameOver() const { return m_GameOver; }
+        const Playfield& GetPlayfield() const { return m_Playfield; }
+
+#ifdef TETRIS_STATE_HASH
+        // Returns the hash of the whole state: the playfield, the falling blocks, the counters and the random numbers
+        // drawn so far. Two games which went through the same ticks have the same hash, so comparing it every tick
+        // finds the first tick where they diverged.
+        uint64_t GetStateHash() const
+        {
+            uint64_t hash = BoardHash::Mix(m_BoardHash.Get() ^ m_RandomHash);
+
+            if (m_pCurrentBlock != NULL)
+            {
+                hash = BoardHash::Mix(hash + ((uint64_t)m_pCurrentBlock->Color << 56) + ((uint64_t)(unsigned short)m_pCurrentBlock->X << 32) +
+                    ((uint64_t)(unsigned short)m_pCurrentBlock->Y << 16) + m_pCurrentBlock->OriIndex);
+            }
+            if (m_pNextBlock != NULL)
+                hash = BoardHash::Mix(hash + ((uint64_t)m_pNextBlock->Color << 32) + (unsigned)m_pNextBlock->X);
+
+            hash = BoardHash::Mix(hash + ((uint64_t)(unsigned)m_ActualPoints << 32) + (unsigned)m_LinesCompleted);
+            return BoardHash::Mix(hash + ((uint64_t)m_ActualLevel << 2) + (m_GameOver ? 2 : 0) + (m_IsPaused ? 1 : 0));
+        }
+
+        // Computes the hash of the playfield again from its cells. It has to be called after changing the playfield
+        // directly instead of through the game.
+        void RecalculateStateHash()
+        {
+            m_BoardHash.Init(m_Playfield.m_Rows);
+            for (int y = 0; y < m_Playfield.m_Height; y++)
+                for (int x = 0; x < m_Playfield.m_Columns; x++)
+                    m_BoardHash.AddCell(x, y, m_Playfield.GetCell(x, y));
+        }
+#endif
+
+#ifdef TETRIS_INSTRUMENTATION
+        const TetrisStats& GetStats() const { return m_Playfield.Stats; }
+        void ResetStats() { m_Playfield.Stats.Reset(); }
+
+        // Prints the instrumentation counters and latency histograms through the host
+        void DumpStats()
+        {
+            const TetrisStats& stats = m_Playfield.Stats;
+            char line[96];
+
+            snprintf(line, sizeof(line), "placement tests: %lu\r\nlocks: %lu\r\nrows cleared: %lu\r\nallocations: %lu\r\n",
+                stats.PlacementTests, stats.Locks, stats.RowsCleared, stats.Allocations);
+            m_pHost->Print(line);
+
+            for (int i = 0; i < HostCallKindCount; i++)
+            {
+                snprintf(line, sizeof(line), "host %s: %lu\r\n", TetrisStats::GetHostCallName(i), stats.HostCalls[i]);
+                m_pHost->Print(line);
+            }
+
+            DumpLatency("Run", stats.RunLatency);
+            DumpLatency("Drop", stats.DropLatency);
+            DumpLatency("Rotate", stats.RotateLatency);
+        }
+#endif
+
+        // Records the output into the specified command buffer instead of calling the Host drawing functions, which
+        // lets the host display a whole frame at once. NULL restores the direct calls.
+        void SetCommandBuffer(RenderCommandBuffer* pCommands)
+        {
+            FlushCommands();
+            m_pCommands = pCommands;
+        }
+
+        // Passes the recorded commands to the host and empties the command buffer, typically once per frame
+        void FlushCommands()
+        {
+            if (m_pCommands == NULL || m_pCommands->GetCount() == 0)
+                return;
+
+            {
+                TETRIS_STAT_HOST_CALL(m_Playfield.Stats, CallExecuteCommands);
+                TETRIS_TRACE_SCOPE("Host::ExecuteCommands");
+                m_pHost->ExecuteCommands(&m_Playfield, m_pCommands);
+            }
+
+            m_pCommands->Clear();
+        }
+
+        // Keeps the specified framebuffer up to date with the composited view of the game, NULL stops updating it.
+        // The framebuffer is (re)allocated to the size of the playfield here and never during the game.
+        void SetFramebuffer(Framebuffer* pFramebuffer)
+        {
+            m_pFramebuffer = pFramebuffer;
+            if (m_pFramebuffer == NULL)
+                return;
+
+            m_pFramebuffer->Init(m_Playfield.m_Rows, m_Playfield.m_Columns);
+            m_pFramebuffer->SetRows(&m_Playfield, 0, m_Playfield.m_Rows);
+            if (m_pCurrentBlock != NULL && !m_GameOver)
+                m_pFramebuffer->SetBlock(m_pCurrentBlock, m_pCurrentBlock->Color);
+            if (m_pNextBlock != NULL)
+                m_pFramebuffer->SetNextBlock(m_pNextBlock);
+        }
+
+        // Copies the state of the specified game (playfield, rotation rules, blocks and counters) into this one
+        // without displaying anything, e.g. to simulate moves on a copy. The playfields have to be of the same size.
+        void CopyState(const Tetris& other)
+        {
+            m_Playfield.CopyFrom(other.m_Playfield);
+            m_Playfield.SetRotationSystem(other.m_Playfield.GetRotationSystem());
+            CopyBlock(m_pCurrentBlock, other.m_pCurrentBlock);
+            CopyBlock(m_pNextBlock, other.m_pNextBlock);
+
+            m_ActualLevel = other.m_ActualLevel;
+            m_ActualPoints = other.m_ActualPoints;
+            m_LinesCompleted = other.m_LinesCompleted;
+            m_IsPaused = other.m_IsPaused;
+            m_GameOver = other.m_GameOver;
+
+#ifdef TETRIS_STATE_HASH
+            m_BoardHash.CopyFrom(other.m_BoardHash);
+            m_RandomHash = other.m_RandomHash;
+#endif
+        }
+
+        // Sets the rotation rules of the game (see Playfield::SetRotationSystem)
+        void SetRotationSystem(const RotationSystem* pRotationSystem)
+        {
+            m_Playfield.SetRotationSystem(pRotationSystem);
+        }
 
         // Pauses the current game
         virtual void Pause()
@@ -517,6 +1268,8 @@ namespace Nanochord
         // Runs the game
         virtual int Run()
         {
+            TETRIS_STAT_LATENCY(m_Playfield.Stats, RunLatency);
+
             PlacementTestResult res;
             int interval = Run(&res, false);
             return interval;
@@ -529,9 +1282,7 @@ namespace Nanochord
                 PlacementTestResult res = m_Playfield.PlacementTest(m_pCurrentBlock->GetCurrentBitmap(), m_pCurrentBlock->X - 1, m_pCurrentBlock->Y);
                 if (res == PlacementTestResult::Succeeded)
                 {
-                    m_pHost->ClearBlock(m_pCurrentBlock);
-                    m_pCurrentBlock->X--;
-                    m_pHost->DrawBlock(m_pCurrentBlock);
+                    MoveCurrentBlock(m_pCurrentBlock->X - 1, m_pCurrentBlock->Y, m_pCurrentBlock->OriIndex);
                 }
             }
         }
@@ -543,67 +1294,32 @@ namespace Nanochord
                 PlacementTestResult res = m_Playfield.PlacementTest(m_pCurrentBlock->GetCurrentBitmap(), m_pCurrentBlock->X + 1, m_pCurrentBlock->Y);
                 if (res == PlacementTestResult::Succeeded)
                 {
-                    m_pHost->ClearBlock(m_pCurrentBlock);
-                    m_pCurrentBlock->X++;
-                    m_pHost->DrawBlock(m_pCurrentBlock);
+                    MoveCurrentBlock(m_pCurrentBlock->X + 1, m_pCurrentBlock->Y, m_pCurrentBlock->OriIndex);
                 }
             }
         }
 
         virtual void Rotate()
         {
+            TETRIS_STAT_LATENCY(m_Playfield.Stats, RotateLatency);
+
             if (m_pCurrentBlock != NULL && !m_IsPaused && !m_GameOver && m_pCurrentBlock->OriCount > 1)
             {
                 byte idx = (m_pCurrentBlock->OriIndex == m_pCurrentBlock->OriCount - 1 ? 0 : m_pCurrentBlock->OriIndex + 1);
+                int x = 0;
+                int y = 0;
 
-                PlacementTestResult res = m_Playfield.PlacementTest(m_pCurrentBlock->OriBitmaps[idx], m_pCurrentBlock->X, m_pCurrentBlock->Y);
-
-                if (res == PlacementTestResult::Failed)
-                    return;
-
-                byte offs = (res == PlacementTestResult::Succeeded ? 0 : -100); //?
-
-                if (res == PlacementTestResult::StickoutLeft)
+                if (m_Playfield.RotationTest(m_pCurrentBlock, m_pCurrentBlock->OriIndex, idx, m_pCurrentBlock->X, m_pCurrentBlock->Y, x, y))
                 {
-                    res = m_Playfield.PlacementTest(m_pCurrentBlock->OriBitmaps[idx], m_pCurrentBlock->X + 1, m_pCurrentBlock->Y);
-
-                    if (res == PlacementTestResult::Succeeded)
-                    {
-                        offs = 1;
-                    }
-                    else
-                    {
-                        if (m_pCurrentBlock->IsI)
-                        {
-                            res = m_Playfield.PlacementTest(m_pCurrentBlock->OriBitmaps[idx], m_pCurrentBlock->X + 2, m_pCurrentBlock->Y);
-                            if (res == PlacementTestResult::Succeeded)
-                            {
-                                offs = 2;
-                            }
-                        }
-                    }
-                }
-                else if (res == PlacementTestResult::StickoutRight)
-                {
-                    res = m_Playfield.PlacementTest(m_pCurrentBlock->OriBitmaps[idx], m_pCurrentBlock->X - 1, m_pCurrentBlock->Y);
-                    if (res == PlacementTestResult::Succeeded)
-                    {
-                        offs = -1;
-                    }
-                }
-
-                if (offs != -100) //?
-                {
-                    m_pHost->ClearBlock(m_pCurrentBlock);
-                    m_pCurrentBlock->X += offs;
-                    m_pCurrentBlock->OriIndex = idx;
-                    m_pHost->DrawBlock(m_pCurrentBlock);
+                    MoveCurrentBlock(x, y, idx);
                 }
             }
         }
 
         virtual int Drop()
         {
+            TETRIS_STAT_LATENCY(m_Playfield.Stats, DropLatency);
+
             int interval = 0;
 
             if (m_pCurrentBlock != NULL && !m_IsPaused && !m_GameOver)
@@ -620,11 +1336,257 @@ namespace Nanochord
 
     protected:
 
+        // Host callbacks. The game logic calls the host only through these functions.
+
+        void HostClearBackground()
+        {
+            if (m_pFramebuffer != NULL)
+                m_pFramebuffer->Clear();
+
+            if (m_pCommands != NULL)
+            {
+                // Everything recorded before is overdrawn anyway
+                m_pCommands->Clear();
+                AddCommand(RenderClearBackground);
+                return;
+            }
+
+            TETRIS_STAT_HOST_CALL(m_Playfield.Stats, CallClearBackground);
+            TETRIS_TRACE_SCOPE("Host::ClearBackground");
+            m_pHost->ClearBackground();
+        }
+
+        void HostDrawBlock(const Block* pBlock)
+        {
+            if (m_pFramebuffer != NULL)
+                m_pFramebuffer->SetBlock(pBlock, pBlock->Color);
+
+            if (m_pCommands != NULL)
+            {
+                AddBlockCommands(pBlock, pBlock->Color);
+                return;
+            }
+
+            TETRIS_STAT_HOST_CALL(m_Playfield.Stats, CallDrawBlock);
+            TETRIS_TRACE_SCOPE("Host::DrawBlock");
+            m_pHost->DrawBlock(pBlock);
+        }
+
+        void HostDrawNextBlock(const Block* pBlock)
+        {
+            if (m_pFramebuffer != NULL)
+                m_pFramebuffer->SetNextBlock(pBlock);
+
+            if (m_pCommands != NULL)
+            {
+                const byte* bmp = pBlock->GetCurrentBitmap();
+                RenderCommand& cmd = AddCommand(RenderNextBlock);
+                cmd.Color = pBlock->Color;
+                for (int i = 0; i < 4; i++)
+                    cmd.Bitmap[i] = bmp[i];
+                return;
+            }
+
+            TETRIS_STAT_HOST_CALL(m_Playfield.Stats, CallDrawNextBlock);
+            TETRIS_TRACE_SCOPE("Host::DrawNextBlock");
+            m_pHost->DrawNextBlock(pBlock);
+        }
+
+        void HostClearBlock(const Block* pBlock)
+        {
+            if (m_pFramebuffer != NULL)
+                m_pFramebuffer->SetBlock(pBlock, 0);
+
+            if (m_pCommands != NULL)
+            {
+                AddBlockCommands(pBlock, 0);
+                return;
+            }
+
+            TETRIS_STAT_HOST_CALL(m_Playfield.Stats, CallClearBlock);
+            TETRIS_TRACE_SCOPE("Host::ClearBlock");
+            m_pHost->ClearBlock(pBlock);
+        }
+
+        void HostPaintPlayground(const Playfield* pPlayfield)
+        {
+            if (m_pFramebuffer != NULL)
+                m_pFramebuffer->SetRows(pPlayfield, 0, pPlayfield->GetRows());
+
+            if (m_pCommands != NULL)
+            {
+                HostPaintRows(pPlayfield, 0, pPlayfield->GetRows());
+                return;
+            }
+
+            TETRIS_STAT_HOST_CALL(m_Playfield.Stats, CallPaintPlayground);
+            TETRIS_TRACE_SCOPE("Host::PaintPlayground");
+            m_pHost->PaintPlayground(pPlayfield);
+        }
+
+        void HostPaintRows(const Playfield* pPlayfield, int fromRow, int toRow)
+        {
+            if (m_pFramebuffer != NULL)
+                m_pFramebuffer->SetRows(pPlayfield, fromRow, toRow);
+
+            if (m_pCommands != NULL)
+            {
+                RenderCommand& cmd = AddCommand(RenderPaintRows);
+                cmd.Y = fromRow;
+                cmd.Count = toRow - fromRow;
+                return;
+            }
+
+            TETRIS_STAT_HOST_CALL(m_Playfield.Stats, CallPaintRows);
+            TETRIS_TRACE_SCOPE("Host::PaintRows");
+            m_pHost->PaintRows(pPlayfield, fromRow, toRow);
+        }
+
+        bool HostMoveBlock(const Block* pBlock, const BlockMove* pMove)
+        {
+            if (m_pFramebuffer != NULL)
+            {
+                for (int i = 0; i < pMove->EraseCount; i++)
+                    m_pFramebuffer->SetCell(pMove->Erase[i].X, pMove->Erase[i].Y, 0);
+                for (int i = 0; i < pMove->PaintCount; i++)
+                    m_pFramebuffer->SetCell(pMove->Paint[i].X, pMove->Paint[i].Y, pBlock->Color);
+            }
+
+            if (m_pCommands != NULL)
+            {
+                for (int i = 0; i < pMove->EraseCount; i++)
+                    AddFillCommand(pMove->Erase[i].X, pMove->Erase[i].Y, 0);
+                for (int i = 0; i < pMove->PaintCount; i++)
+                    AddFillCommand(pMove->Paint[i].X, pMove->Paint[i].Y, pBlock->Color);
+                return true;
+            }
+
+            TETRIS_STAT_HOST_CALL(m_Playfield.Stats, CallMoveBlock);
+            TETRIS_TRACE_SCOPE("Host::MoveBlock");
+            return m_pHost->MoveBlock(pBlock, pMove);
+        }
+
+        int HostRandom(int max)
+        {
+            TETRIS_STAT_HOST_CALL(m_Playfield.Stats, CallRandom);
+            TETRIS_TRACE_SCOPE("Host::Random");
+#ifdef TETRIS_STATE_HASH
+            int r = m_pHost->Random(max);
+            m_RandomHash = BoardHash::Mix(m_RandomHash + ((uint64_t)(unsigned)max << 32) + (unsigned)r + 1);
+            return r;
+#else
+            return m_pHost->Random(max);
+#endif
+        }
+
+        void HostTetrisEvent(TetrisEventKind kind)
+        {
+            TETRIS_STAT_HOST_CALL(m_Playfield.Stats, CallTetrisEvent);
+            TETRIS_TRACE_SCOPE("Host::TetrisEvent");
+            m_pHost->TetrisEvent(kind);
+        }
+
+        // Appends a command to the command buffer. A full buffer is flushed first.
+        RenderCommand& AddCommand(RenderCommandKind kind)
+        {
+            if (m_pCommands->IsFull())
+                FlushCommands();
+
+            return m_pCommands->Add(kind);
+        }
+
+        void AddFillCommand(int x, int y, byte color)
+        {
+            RenderCommand& cmd = AddCommand(RenderFillCell);
+            cmd.X = x;
+            cmd.Y = y;
+            cmd.Color = color;
+        }
+
+        // Records the cells of the specified block which are inside the playfield
+        void AddBlockCommands(const Block* pBlock, byte color)
+        {
+            const byte* bmp = pBlock->GetCurrentBitmap();
+
+            for (int i = 0; i < 4; i++)
+            {
+                int yy = pBlock->Y + 1 - i;
+                if (bmp[i] == 0 || yy < 0 || yy >= m_Playfield.m_Rows)
+                    continue;
+
+                for (int k = 0; k < 4; k++)
+                {
+                    int xx = pBlock->X - 2 + k;
+                    if ((bmp[i] & (0x8 >> k)) != 0 && xx >= 0 && xx < m_Playfield.m_Columns)
+                        AddFillCommand(xx, yy, color);
+                }
+            }
+        }
+
+#ifdef TETRIS_INSTRUMENTATION
+        void DumpLatency(const char* name, const LatencyHistogram& histogram)
+        {
+            char line[96];
+
+            snprintf(line, sizeof(line), "%s latency: n=%lu min=%lu p50<=%lu p99<=%lu max=%lu\r\n", name, histogram.Count,
+                histogram.Min, histogram.GetPercentile(50), histogram.GetPercentile(99), histogram.Max);
+            m_pHost->Print(line);
+        }
+#endif
+
+        // Creates a block of the specified color (1-7), every kind of block has its own color
+        static Block* CreateBlock(byte color)
+        {
+            switch (color)
+            {
+            case 1:
+                return new Block_O();
+            case 2:
+                return new Block_I();
+            case 3:
+                return new Block_S();
+            case 4:
+                return new Block_Z();
+            case 5:
+                return new Block_L();
+            case 6:
+                return new Block_J();
+            case 7:
+                return new Block_T();
+            }
+
+            return NULL;
+        }
+
+        // Makes the target block a copy of the source block. The bitmaps belong to the block, so a block of the same
+        // kind is created when the kinds differ.
+        void CopyBlock(Block*& pTo, const Block* pFrom)
+        {
+            if (pTo != NULL && (pFrom == NULL || pTo->Color != pFrom->Color))
+            {
+                delete pTo;
+                pTo = NULL;
+            }
+
+            if (pFrom == NULL)
+                return;
+
+            if (pTo == NULL)
+            {
+                pTo = CreateBlock(pFrom->Color);
+                TETRIS_STAT_INC(m_Playfield.Stats, Allocations);
+            }
+
+            pTo->X = pFrom->X;
+            pTo->Y = pFrom->Y;
+            pTo->OriIndex = pFrom->OriIndex;
+        }
+
         virtual Block* CreateNewRandomBlock()
         {
             Block* pBlock = NULL;
 
-            switch (m_pHost->Random(8))
+            switch (HostRandom(8))
             {
             default:
             case 0:
@@ -652,9 +1614,10 @@ namespace Nanochord
 
             if (pBlock)
             {
+                TETRIS_STAT_INC(m_Playfield.Stats, Allocations);
                 pBlock->Y = m_Playfield.m_Rows - 1;
                 //pBlock->X = m_Playfield.m_Columns / 2;
-                pBlock->X = m_pHost->Random(m_Playfield.m_Columns - 4) + 2;
+                pBlock->X = HostRandom(m_Playfield.m_Columns - 4) + 2;
             }
 
             return pBlock;
@@ -662,41 +1625,88 @@ namespace Nanochord
 
         virtual PlacementTestResult DoRun()
         {
+            TETRIS_TRACE_SCOPE("DoRun");
+
             PlacementTestResult ptr = m_Playfield.PlacementTest(m_pCurrentBlock->GetCurrentBitmap(), m_pCurrentBlock->X, m_pCurrentBlock->Y - 1);
 
             if (ptr != PlacementTestResult::Succeeded)
             {
                 // touchdown
+#ifdef TETRIS_STATE_HASH
+                HashOccupy(m_pCurrentBlock);
+#endif
                 m_Playfield.Occupy(m_pCurrentBlock);
 
                 delete m_pCurrentBlock;
                 m_pCurrentBlock = m_pNextBlock;
                 m_pNextBlock = CreateNewRandomBlock();
-                m_pHost->DrawNextBlock(m_pNextBlock);
+                HostDrawNextBlock(m_pNextBlock);
 
                 PlacementTestResult ptr2 = m_Playfield.PlacementTest(m_pCurrentBlock->GetCurrentBitmap(), m_pCurrentBlock->X, m_pCurrentBlock->Y);
                 if (ptr2 != PlacementTestResult::Succeeded)
                 {
                     m_GameOver = true;
-                    m_pHost->TetrisEvent(TetrisEventKind::GameOver);
+                    HostTetrisEvent(TetrisEventKind::GameOver);
+                }
+                else
+                {
+                    HostDrawBlock(m_pCurrentBlock);
                 }
             }
             else
             {
-                m_pHost->ClearBlock(m_pCurrentBlock);
-                m_pCurrentBlock->Y--;
+                MoveCurrentBlock(m_pCurrentBlock->X, m_pCurrentBlock->Y - 1, m_pCurrentBlock->OriIndex);
             }
 
-            if (!m_GameOver)
+            return ptr;
+        }
+
+#ifdef TETRIS_STATE_HASH
+        // Adds the cells of the block which is about to occupy the playfield to the hash
+        void HashOccupy(const Block* pBlock)
+        {
+            const byte* currBmp = pBlock->GetCurrentBitmap();
+
+            for (int i = 0; i < 4; i++)
             {
-                m_pHost->DrawBlock(m_pCurrentBlock);
+                for (int k = 0; k < 4; k++)
+                {
+                    if ((currBmp[i] & (0x8 >> k)) != 0)
+                        m_BoardHash.AddCell(pBlock->X - 2 + k, pBlock->Y + 1 - i, pBlock->Color);
+                }
             }
+        }
+#endif
 
-            return ptr;
+        // Moves the current block to the specified pose and displays the movement
+        void MoveCurrentBlock(int x, int y, byte oriIndex)
+        {
+            BlockMove move;
+            move.Set(m_pCurrentBlock, x, y, oriIndex, m_Playfield.m_Rows, m_Playfield.m_Columns);
+
+            m_pCurrentBlock->X = x;
+            m_pCurrentBlock->Y = y;
+            m_pCurrentBlock->OriIndex = oriIndex;
+
+            if (HostMoveBlock(m_pCurrentBlock, &move))
+                return;
+
+            // The host does not support moves, the block is cleared at its old pose and drawn at the new one
+            m_pCurrentBlock->X = move.OldX;
+            m_pCurrentBlock->Y = move.OldY;
+            m_pCurrentBlock->OriIndex = move.OldOriIndex;
+            HostClearBlock(m_pCurrentBlock);
+
+            m_pCurrentBlock->X = x;
+            m_pCurrentBlock->Y = y;
+            m_pCurrentBlock->OriIndex = oriIndex;
+            HostDrawBlock(m_pCurrentBlock);
         }
 
         virtual int Run(PlacementTestResult* pres, bool isDropped)
         {
+            TETRIS_TRACE_SCOPE("Run");
+
             if (m_pCurrentBlock == NULL)
                 return -1;
 
@@ -708,7 +1718,7 @@ namespace Nanochord
                 if (*pres != PlacementTestResult::Succeeded)
                 {
                     m_ActualPoints++; // TODO: It simply increases the number of points.
-                    m_pHost->TetrisEvent(TetrisEventKind::Touchdown);
+                    HostTetrisEvent(TetrisEventKind::Touchdown);
                 }
 
                 // completed rows test
@@ -716,14 +1726,21 @@ namespace Nanochord
 
                 if (cnt > 0)
                 {
-                    for (byte i = 0; i < cnt; i++)
                     {
-                        m_Playfield.ClearRow(m_Playfield.CompletedLines[i]);
+                        TETRIS_TRACE_SCOPE("ClearRows");
+
+                        for (byte i = 0; i < cnt; i++)
+                        {
+#ifdef TETRIS_STATE_HASH
+                            m_BoardHash.RemoveRow(m_Playfield.CompletedLines[i]);
+#endif
+                            m_Playfield.ClearRow(m_Playfield.CompletedLines[i]);
+                        }
                     }
 
                     m_LinesCompleted++;
 
-                    m_pHost->TetrisEvent(TetrisEventKind::RowCompleted);
+                    HostTetrisEvent(TetrisEventKind::RowCompleted);
 
                     if (m_LinesCompleted <= 0)
                     {
@@ -732,18 +1749,21 @@ namespace Nanochord
                     else if ((m_LinesCompleted >= 1) && (m_LinesCompleted <= 90))
                     {
                         m_ActualLevel = 1 + ((m_LinesCompleted - 1) / 10);
-                        m_pHost->TetrisEvent(TetrisEventKind::LevelChanged);
+                        HostTetrisEvent(TetrisEventKind::LevelChanged);
                     }
                     else if (m_LinesCompleted >= 91)
                     {
                         m_ActualLevel = 10;
-                        m_pHost->TetrisEvent(TetrisEventKind::LevelChanged);
+                        HostTetrisEvent(TetrisEventKind::LevelChanged);
                     }
 
-                    m_pHost->PaintPlayground(&m_Playfield);
-                    m_pHost->DrawBlock(m_pCurrentBlock);
+                    HostPaintRows(&m_Playfield, m_Playfield.GetDamageFrom(), m_Playfield.GetDamageTo());
+                    HostDrawBlock(m_pCurrentBlock);
                 }
 
+                // The locked block has already been drawn by the host, so only the moved rows needed a repaint
+                m_Playfield.ResetDamage();
+
                 return m_ActualLevel;
             }
 
@@ -0,0 +1,158 @@
+/*
+    Nanochord.Tetris
+
+    C interface for running batches of headless games - implementation
+
+    MIT License - see Tetris.h for details.
+ */
+
+#include "TetrisC.h"
+#include "TetrisHeadless.h"
+#include "TetrisObservation.h"
+#include <new>
+#include <vector>
+
+using namespace Nanochord;
+
+struct tetris_batch
+{
+    std::vector<HeadlessHost*> Hosts;
+    std::vector<ObservationTetris*> Games;
+    std::vector<byte> Observations;
+    ObservationLayout Layout;
+
+    ~tetris_batch()
+    {
+        for (size_t i = 0; i < Games.size(); i++)
+            delete Games[i];
+        for (size_t i = 0; i < Hosts.size(); i++)
+            delete Hosts[i];
+    }
+};
+
+extern "C"
+{
+
+tetris_batch* tetris_batch_create(int count, int rows, int columns, int with_colors, uint64_t seed)
+{
+    if (count <= 0)
+        return NULL;
+
+    tetris_batch* batch = new (std::nothrow) tetris_batch();
+    if (batch == NULL)
+        return NULL;
+
+    try
+    {
+        for (int i = 0; i < count; i++)
+        {
+            batch->Hosts.push_back(new HeadlessHost(seed + (uint64_t)i));
+            batch->Games.push_back(new ObservationTetris(batch->Hosts[i], rows, columns, with_colors != 0));
+        }
+
+        // The playfield may be larger than requested (minimum 10x10), the layout comes from the game
+        batch->Layout = batch->Games[0]->GetLayout();
+        batch->Observations.assign(count * batch->Layout.Size, 0);
+
+        for (int i = 0; i < count; i++)
+        {
+            batch->Games[i]->SetObservationBuffer(&batch->Observations[i * batch->Layout.Size]);
+            batch->Games[i]->Start();
+        }
+    }
+    catch (...)
+    {
+        delete batch;
+        return NULL;
+    }
+
+    return batch;
+}
+
+void tetris_batch_destroy(tetris_batch* batch)
+{
+    delete batch;
+}
+
+int tetris_batch_count(const tetris_batch* batch)
+{
+    return (int)batch->Games.size();
+}
+
+void tetris_batch_layout(const tetris_batch* batch, tetris_layout* layout)
+{
+    const ObservationLayout& l = batch->Layout;
+
+    layout->rows = l.Rows;
+    layout->columns = l.Columns;
+    layout->has_colors = l.HasColors ? 1 : 0;
+    layout->next_count = ObservationLayout::BlockKindCount;
+    layout->row_stride = (int64_t)l.RowStride;
+    layout->occupancy_offset = (int64_t)l.OccupancyOffset;
+    layout->color_offset = (int64_t)l.ColorOffset;
+    layout->block_offset = (int64_t)l.BlockOffset;
+    layout->next_offset = (int64_t)l.NextOffset;
+    layout->game_stride = (int64_t)l.Size;
+}
+
+uint8_t* tetris_batch_observations(tetris_batch* batch)
+{
+    return batch->Observations.data();
+}
+
+void tetris_batch_reset(tetris_batch* batch, int game)
+{
+    for (int i = 0; i < (int)batch->Games.size(); i++)
+        if (game < 0 || game == i)
+            batch->Games[i]->Start();
+}
+
+void tetris_batch_step(tetris_batch* batch, const uint8_t* actions, int32_t* lines, uint8_t* done)
+{
+    for (size_t i = 0; i < batch->Games.size(); i++)
+    {
+        ObservationTetris* pGame = batch->Games[i];
+        int linesBefore = pGame->GetLinesCompleted();
+
+        if (!pGame->GetGameOver())
+        {
+            switch (actions != NULL ? actions[i] : TETRIS_ACTION_NONE)
+            {
+            case TETRIS_ACTION_LEFT:
+                pGame->MoveLeft();
+                break;
+            case TETRIS_ACTION_RIGHT:
+                pGame->MoveRight();
+                break;
+            case TETRIS_ACTION_ROTATE:
+                pGame->Rotate();
+                break;
+            case TETRIS_ACTION_DROP:
+                pGame->Drop();
+                break;
+            }
+
+            if (!pGame->GetGameOver())
+                pGame->Run();
+        }
+
+        if (lines != NULL)
+            lines[i] = pGame->GetLinesCompleted() - linesBefore;
+        if (done != NULL)
+            done[i] = pGame->GetGameOver() ? 1 : 0;
+    }
+}
+
+void tetris_batch_score(const tetris_batch* batch, int game, int32_t* points, int32_t* lines, int32_t* level)
+{
+    const ObservationTetris* pGame = batch->Games[game];
+
+    if (points != NULL)
+        *points = pGame->GetActualPoints();
+    if (lines != NULL)
+        *lines = pGame->GetLinesCompleted();
+    if (level != NULL)
+        *level = pGame->GetActualLevel();
+}
+
+}
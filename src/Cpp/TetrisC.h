@@ -0,0 +1,88 @@
+/*
+    Nanochord.Tetris
+
+    C interface for running batches of headless games from other languages (e.g. Python through ctypes or cffi)
+
+    MIT License - see Tetris.h for details.
+
+    Build it as a shared library from the repository root, e.g.:
+        g++ -std=c++11 -O2 -shared -fPIC -I src/Cpp src/Cpp/TetrisC.cpp -o libtetris.so
+
+    The observations of all the games of a batch are in one contiguous buffer which is updated in place by every
+    step, so it can be wrapped (e.g. with numpy.frombuffer) once and read without copying:
+        buffer[game * layout.game_stride + layout.occupancy_offset + row * layout.row_stride + column]
+ */
+
+#ifndef _Nanochord_TetrisC_
+#define _Nanochord_TetrisC_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#if defined(_WIN32)
+#define TETRIS_API __declspec(dllexport)
+#else
+#define TETRIS_API __attribute__((visibility("default")))
+#endif
+
+/* Actions of a step */
+enum
+{
+    TETRIS_ACTION_NONE = 0,
+    TETRIS_ACTION_LEFT = 1,
+    TETRIS_ACTION_RIGHT = 2,
+    TETRIS_ACTION_ROTATE = 3,
+    TETRIS_ACTION_DROP = 4
+};
+
+/* Memory layout of the observation buffer, every offset and stride is in bytes and every value is a uint8 */
+typedef struct tetris_layout
+{
+    int32_t rows;
+    int32_t columns;
+    int32_t has_colors;
+    int32_t next_count;             /* number of block kinds in the one-hot next block vector */
+    int64_t row_stride;
+    int64_t occupancy_offset;       /* rows x columns, 1 where the playfield is occupied, row 0 is the bottom */
+    int64_t color_offset;           /* rows x columns, color (1-7) of the playfield cells, only if has_colors */
+    int64_t block_offset;           /* rows x columns, 1 where the active block is */
+    int64_t next_offset;            /* next_count values, one-hot kind of the next block */
+    int64_t game_stride;            /* distance of the observations of two games */
+} tetris_layout;
+
+typedef struct tetris_batch tetris_batch;
+
+/* Creates a batch of games. The games are seeded from the specified seed and started. Returns NULL on failure. */
+TETRIS_API tetris_batch* tetris_batch_create(int count, int rows, int columns, int with_colors, uint64_t seed);
+
+TETRIS_API void tetris_batch_destroy(tetris_batch* batch);
+
+TETRIS_API int tetris_batch_count(const tetris_batch* batch);
+
+TETRIS_API void tetris_batch_layout(const tetris_batch* batch, tetris_layout* layout);
+
+/* Returns the observation buffer of the whole batch, count * game_stride bytes. It stays valid until destroy. */
+TETRIS_API uint8_t* tetris_batch_observations(tetris_batch* batch);
+
+/* Restarts the specified game, or every game if it is negative */
+TETRIS_API void tetris_batch_reset(tetris_batch* batch, int game);
+
+/*
+    Applies one action to every game (actions has count elements, NULL means no action) and advances them by one
+    tick. The increase of the completed lines counter (see tetris_batch_score) and the game over flags are written
+    to the optional lines and done arrays. Finished games are not restarted automatically.
+*/
+TETRIS_API void tetris_batch_step(tetris_batch* batch, const uint8_t* actions, int32_t* lines, uint8_t* done);
+
+/* Returns the points, the completed rows and the level of the specified game */
+TETRIS_API void tetris_batch_score(const tetris_batch* batch, int game, int32_t* points, int32_t* lines, int32_t* level);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,365 @@
+/*
+    Nanochord.Tetris
+
+    Compact playfield for tiny RAM targets: one occupancy bit and a 4-bit color per cell in inline storage, piece
+    tables in flash and a static memory footprint report
+
+    MIT License - see Tetris.h for details.
+ */
+
+#ifndef _Nanochord_TetrisCompact_
+#define _Nanochord_TetrisCompact_
+
+#include "Tetris.h"
+
+#if defined(__AVR__)
+#include <avr/pgmspace.h>
+#define TETRIS_PROGMEM PROGMEM
+#define TETRIS_READ_PROGMEM_BYTE(p) pgm_read_byte(p)
+#else
+#define TETRIS_PROGMEM
+#define TETRIS_READ_PROGMEM_BYTE(p) (*(p))
+#endif
+
+namespace Nanochord
+{
+    /// <summary>
+    /// Cells of a compact playfield. Occupancy has one bit per cell (bit x % 8 of byte x / 8 of the row), Colors has
+    /// 4 bits per cell (the low nibble of byte x / 2 is the even column). Every member is a byte array, so the size
+    /// is the same on every platform.
+    /// </summary>
+    template <int Rows, int Cols>
+    struct CompactCells
+    {
+        static const int OccupancyRowBytes = (Cols + 7) / 8;
+        static const int ColorRowBytes = (Cols + 1) / 2;
+
+        byte Occupancy[Rows][OccupancyRowBytes];
+        byte Colors[Rows][ColorRowBytes];
+    };
+
+    /// <summary>
+    /// Playfield with the cells stored inline in Rows * (Cols / 8 + Cols / 2) bytes (rounded up per row) instead of
+    /// a byte per cell, row pointers and a heap block per row. Collision tests read only the occupancy bits.
+    /// It can be declared as a global or a member and passed to the Tetris(Host*, Playfield*) constructor; no
+    /// memory is allocated. Map is NULL, so hosts have to use GetCell.
+    /// </summary>
+    template <int Rows, int Cols>
+    class CompactPlayfield : public Playfield
+    {
+        static_assert(Rows >= 10 && Cols >= 10, "The playfield is at least 10x10");
+
+    public:
+        CompactPlayfield(Host* pHost) : Playfield(pHost, Rows, Cols, NULL)
+        {
+            for (int y = 0; y < Rows; y++)
+                EmptyRow(y);
+        }
+
+        byte GetCell(int x, int y) const override
+        {
+            byte colors = m_Cells.Colors[y][x >> 1];
+            return (x & 1) != 0 ? colors >> 4 : colors & 0x0F;
+        }
+
+        bool IsRowEmpty(int y) const override
+        {
+            for (int i = 0; i < CompactCells<Rows, Cols>::OccupancyRowBytes; i++)
+                if (m_Cells.Occupancy[y][i] != 0)
+                    return false;
+
+            return true;
+        }
+
+        bool IsRowFull(int y) const override
+        {
+            const int lastByte = CompactCells<Rows, Cols>::OccupancyRowBytes - 1;
+            const byte lastMask = (byte)(0xFF >> (8 * (lastByte + 1) - Cols));
+
+            if (m_Cells.Occupancy[y][lastByte] != lastMask)
+                return false;
+
+            for (int i = 0; i < lastByte; i++)
+                if (m_Cells.Occupancy[y][i] != 0xFF)
+                    return false;
+
+            return true;
+        }
+
+        void SetCell(int x, int y, byte color) override
+        {
+            byte& colors = m_Cells.Colors[y][x >> 1];
+            colors = (x & 1) != 0 ? (byte)((colors & 0x0F) | (color << 4)) : (byte)((colors & 0xF0) | (color & 0x0F));
+
+            byte mask = (byte)(1 << (x & 7));
+            if (color != 0)
+                m_Cells.Occupancy[y][x >> 3] |= mask;
+            else
+                m_Cells.Occupancy[y][x >> 3] &= (byte)~mask;
+
+            AddDamage(y, y + 1);
+
+            if (color != 0 && y >= m_Height)
+                m_Height = y + 1;
+        }
+
+        void Occupy(const Block* pBlock) override
+        {
+            const byte* currBmp = pBlock->GetCurrentBitmap();
+
+            TETRIS_STAT_INC(Stats, Locks);
+
+            for (int i = 0; i < 4; i++)
+            {
+                int yy = pBlock->Y + 1 - i;
+
+                if (yy >= 0 && yy < m_Rows && currBmp[i] != 0)
+                {
+                    for (int k = 0; k < 4; k++)
+                    {
+                        if ((currBmp[i] & (0x8 >> k)) != 0)
+                            SetCell(pBlock->X - 2 + k, yy, pBlock->Color);
+                    }
+                }
+            }
+        }
+
+        int GetCompletedRows() override
+        {
+            TETRIS_TRACE_SCOPE("GetCompletedRows");
+
+            int cnt = 0;
+
+            for (int y = m_Height - 1; y >= 0 && cnt < 4; y--)
+            {
+                if (CompactPlayfield::IsRowFull(y))
+                {
+                    CompletedLines[cnt] = y;
+                    cnt++;
+                }
+            }
+
+            return cnt;
+        }
+
+        void Clear() override
+        {
+            for (int y = 0; y < m_Height; y++)
+                EmptyRow(y);
+
+            AddDamage(0, m_Height);
+            m_Height = 0;
+        }
+
+        void ClearRow(int y) override
+        {
+            TETRIS_STAT_INC(Stats, RowsCleared);
+
+            if (y >= m_Height)
+                return;
+
+            for (int i = y + 1; i < m_Height; i++)
+            {
+                for (int k = 0; k < CompactCells<Rows, Cols>::OccupancyRowBytes; k++)
+                    m_Cells.Occupancy[i - 1][k] = m_Cells.Occupancy[i][k];
+                for (int k = 0; k < CompactCells<Rows, Cols>::ColorRowBytes; k++)
+                    m_Cells.Colors[i - 1][k] = m_Cells.Colors[i][k];
+            }
+
+            EmptyRow(m_Height - 1);
+
+            AddDamage(y, m_Height);
+            m_Height--;
+        }
+
+        void CopyFrom(const Playfield& other) override
+        {
+            Clear();
+
+            for (int y = 0; y < other.GetHeight(); y++)
+            {
+                for (int x = 0; x < m_Columns; x++)
+                {
+                    byte color = other.GetCell(x, y);
+                    if (color != 0)
+                        SetCell(x, y, color);
+                }
+            }
+        }
+
+        void Dump() override
+        {
+            if (m_pHost != NULL)
+            {
+                for (int i = 0; i < m_Rows; i++)
+                {
+                    for (int j = 0; j < m_Columns; j++)
+                    {
+                        TETRIS_STAT_HOST_CALL(Stats, CallPrint);
+                        m_pHost->Print(GetCell(j, i) == 0 ? "0" : "1");
+                    }
+                    TETRIS_STAT_HOST_CALL(Stats, CallPrint);
+                    m_pHost->Print("\r\n");
+                }
+            }
+        }
+
+        PlacementTestResult IsPositionEmpty(int xx, int yy) override
+        {
+            if (xx < 0)
+                return PlacementTestResult::StickoutLeft;
+            if (xx > Cols - 1)
+                return PlacementTestResult::StickoutRight;
+            if (yy < 0)
+                return PlacementTestResult::Failed;
+            if (yy >= m_Height)
+                return PlacementTestResult::Succeeded;
+
+            return (m_Cells.Occupancy[yy][xx >> 3] & (1 << (xx & 7))) != 0 ? PlacementTestResult::Failed : PlacementTestResult::Succeeded;
+        }
+
+    protected:
+        CompactCells<Rows, Cols> m_Cells;
+
+        void EmptyRow(int y)
+        {
+            for (int k = 0; k < CompactCells<Rows, Cols>::OccupancyRowBytes; k++)
+                m_Cells.Occupancy[y][k] = 0;
+            for (int k = 0; k < CompactCells<Rows, Cols>::ColorRowBytes; k++)
+                m_Cells.Colors[y][k] = 0;
+        }
+    };
+
+    /// <summary>
+    /// Bitmaps of every kind of block in flash (PROGMEM on AVR), indexed by the color of the block (1-7). They are the
+    /// same as the bitmaps of the Block classes, e.g. for drawing a preview queue without creating blocks.
+    /// </summary>
+    class CompactPieces
+    {
+    public:
+        // Returns the number of orientations of the block of the specified color
+        static byte GetOriCount(byte color)
+        {
+            return color >= 1 && color <= 7 ? TETRIS_READ_PROGMEM_BYTE(&GetOriCounts()[color - 1]) : 0;
+        }
+
+        // Returns the specified row (0-3, top to bottom) of the bitmap of the block of the specified color
+        static byte GetRow(byte color, byte oriIndex, byte row)
+        {
+            if (oriIndex >= GetOriCount(color) || row > 3)
+                return 0;
+
+            return TETRIS_READ_PROGMEM_BYTE(&GetBitmaps()[color - 1][oriIndex][row]);
+        }
+
+    protected:
+        static const byte* GetOriCounts()
+        {
+            static const byte oriCounts[7] TETRIS_PROGMEM = { 1, 2, 2, 2, 4, 4, 4 };
+            return oriCounts;
+        }
+
+        typedef byte PieceBitmaps[4][4];
+
+        static const PieceBitmaps* GetBitmaps()
+        {
+            static const byte bitmaps[7][4][4] TETRIS_PROGMEM =
+            {
+                { { 0, 6, 6, 0 } },                                                     // O
+                { { 0, 15, 0, 0 }, { 2, 2, 2, 2 } },                                    // I
+                { { 0, 3, 6, 0 }, { 2, 3, 1, 0 } },                                     // S
+                { { 0, 6, 3, 0 }, { 1, 3, 2, 0 } },                                     // Z
+                { { 0, 7, 4, 0 }, { 2, 2, 3, 0 }, { 1, 7, 0, 0 }, { 6, 2, 2, 0 } },     // L
+                { { 0, 7, 1, 0 }, { 3, 2, 2, 0 }, { 4, 7, 0, 0 }, { 2, 2, 6, 0 } },     // J
+                { { 0, 7, 2, 0 }, { 2, 3, 2, 0 }, { 2, 7, 0, 0 }, { 2, 6, 2, 0 } },     // T
+            };
+            return bitmaps;
+        }
+    };
+
+    /// <summary>
+    /// Queue of the upcoming blocks, stored as one color byte per block instead of Block objects
+    /// </summary>
+    template <int Capacity>
+    class CompactBlockQueue
+    {
+        static_assert(Capacity > 0 && Capacity <= 255, "The queue is indexed with a byte");
+
+    public:
+        CompactBlockQueue() : m_First(0), m_Count(0)
+        {
+        }
+
+        int GetCount() const { return m_Count; }
+        bool IsFull() const { return m_Count == Capacity; }
+
+        // Returns the color of the specified upcoming block, 0 is the next one
+        byte Get(int index) const
+        {
+            return m_Colors[(m_First + index) % Capacity];
+        }
+
+        // Appends a block. Returns false if the queue is full.
+        bool Push(byte color)
+        {
+            if (m_Count == Capacity)
+                return false;
+
+            m_Colors[(m_First + m_Count) % Capacity] = color;
+            m_Count++;
+            return true;
+        }
+
+        // Removes the next block and returns its color, 0 if the queue is empty
+        byte Pop()
+        {
+            if (m_Count == 0)
+                return 0;
+
+            byte color = m_Colors[m_First];
+            m_First = (byte)((m_First + 1) % Capacity);
+            m_Count--;
+            return color;
+        }
+
+        void Clear()
+        {
+            m_First = 0;
+            m_Count = 0;
+        }
+
+    protected:
+        byte m_Colors[Capacity];
+        byte m_First;
+        byte m_Count;
+    };
+
+    /// <summary>
+    /// Static memory footprint of a game setup made of compact playfields and a preview queue. Check it against the
+    /// SRAM budget of the target with static_assert, e.g.:
+    ///     static_assert(CompactFootprint<20, 10, 2, 4>::TotalBytes <= 1024, "Too large for the Uno");
+    /// CellBytes is the same on every platform; the other values include the playfield objects, whose size depends
+    /// on the pointer and int sizes of the platform.
+    /// </summary>
+    template <int Rows, int Cols, int Boards, int PreviewCount>
+    struct CompactFootprint
+    {
+        static const size_t CellBytes = sizeof(CompactCells<Rows, Cols>);
+        static const size_t BoardBytes = sizeof(CompactPlayfield<Rows, Cols>);
+        static const size_t QueueBytes = sizeof(CompactBlockQueue<PreviewCount>);
+        static const size_t TotalBytes = Boards * BoardBytes + QueueBytes;
+
+        // Cells of a Playfield of the same size on the heap: a byte per cell, a row pointer per row and a heap
+        // block per row plus one for the pointers, with the specified pointer and heap header sizes (2 and 2 on AVR)
+        static size_t GetHeapPlayfieldBytes(size_t pointerSize, size_t heapHeaderSize)
+        {
+            return (size_t)Rows * Cols + Rows * pointerSize + (Rows + 1) * heapHeaderSize;
+        }
+    };
+
+    // The standard 10x20 board takes 140 bytes of cells instead of 200 bytes, 20 row pointers and 21 heap blocks
+    static_assert(sizeof(CompactCells<20, 10>) == 20 * 2 + 20 * 5, "Unexpected padding in the compact cells");
+    static_assert(sizeof(CompactBlockQueue<6>) == 8, "Unexpected padding in the compact block queue");
+}
+
+#endif
@@ -0,0 +1,511 @@
+/*
+    Nanochord.Tetris
+
+    Board features for heuristic players: column heights, holes, wells, bumpiness and transitions
+
+    MIT License - see Tetris.h for details.
+ */
+
+#ifndef _Nanochord_TetrisFeatures_
+#define _Nanochord_TetrisFeatures_
+
+#include "Tetris.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <vector>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+namespace Nanochord
+{
+    /// <summary>
+    /// Summary of a board as used by the usual evaluation functions
+    /// </summary>
+    struct BoardFeatures
+    {
+        int AggregateHeight = 0;    // sum of the column heights
+        int MaxHeight = 0;          // height of the highest column
+        int Holes = 0;              // empty cells below the top cell of their column
+        int Bumpiness = 0;          // sum of the height differences of the neighbouring columns
+        int WellDepth = 0;          // sum of the depths of the columns which are lower than both neighbours (walls are full)
+        int RowTransitions = 0;     // occupied/empty changes along the non-empty rows, the walls count as occupied
+        int ColumnTransitions = 0;  // occupied/empty changes along the columns upwards, the floor counts as occupied
+
+        bool operator==(const BoardFeatures& other) const
+        {
+            return AggregateHeight == other.AggregateHeight && MaxHeight == other.MaxHeight && Holes == other.Holes &&
+                Bumpiness == other.Bumpiness && WellDepth == other.WellDepth &&
+                RowTransitions == other.RowTransitions && ColumnTransitions == other.ColumnTransitions;
+        }
+
+        bool operator!=(const BoardFeatures& other) const { return !(*this == other); }
+
+        // Depth of the well at column x, side columns are bordered by the wall
+        static int GetWellDepth(const int* heights, int cols, int rows, int x)
+        {
+            int left = x > 0 ? heights[x - 1] : rows;
+            int right = x < cols - 1 ? heights[x + 1] : rows;
+            int depth = (left < right ? left : right) - heights[x];
+            return depth > 0 ? depth : 0;
+        }
+    };
+
+    /// <summary>
+    /// Board of at most 64 columns as one 64 bit mask per row (bit x is column x). The features of a candidate
+    /// board are computed a whole row at a time with bit operations instead of cell by cell.
+    /// </summary>
+    class BitBoard
+    {
+    public:
+        static const int MaxColumns = 64;
+
+        static int PopCount(uint64_t v)
+        {
+#ifdef _MSC_VER
+            return (int)__popcnt64(v);
+#else
+            return __builtin_popcountll(v);
+#endif
+        }
+
+        static uint64_t GetFullRow(int cols)
+        {
+            return cols >= 64 ? ~0ULL : (1ULL << cols) - 1;
+        }
+
+        // Converts the playfield into row masks, rows must have room for GetRows() values
+        static void FromPlayfield(const Playfield& playfield, uint64_t* rows)
+        {
+            for (int y = 0; y < playfield.GetRows(); y++)
+            {
+                uint64_t mask = 0;
+                if (y < playfield.GetHeight())
+                {
+                    for (int x = 0; x < playfield.GetColumns(); x++)
+                        if (playfield.GetCell(x, y) != 0)
+                            mask |= 1ULL << x;
+                }
+                rows[y] = mask;
+            }
+        }
+
+        // Returns the mask of the specified bitmap row placed at x, or false if it sticks out of the board
+        static bool GetBlockRow(byte bitmapRow, int x, int cols, uint64_t& mask)
+        {
+            mask = 0;
+            for (int k = 0; k < 4; k++)
+            {
+                if ((bitmapRow & (0x8 >> k)) == 0)
+                    continue;
+
+                int xx = x - 2 + k;
+                if (xx < 0 || xx >= cols)
+                    return false;
+                mask |= 1ULL << xx;
+            }
+
+            return true;
+        }
+
+        // Places the 4x4 bitmap at the specified position (same coordinates as Block). Returns false, without
+        // changing the board, if it overlaps the board or sticks out of it.
+        static bool Place(uint64_t* rows, int rowCount, int cols, const byte* bitmap, int x, int y)
+        {
+            uint64_t masks[4];
+
+            for (int i = 0; i < 4; i++)
+            {
+                int yy = y + 1 - i;
+                if (!GetBlockRow(bitmap[i], x, cols, masks[i]))
+                    return false;
+                if (masks[i] != 0 && (yy < 0 || yy >= rowCount || (rows[yy] & masks[i]) != 0))
+                    return false;
+            }
+
+            for (int i = 0; i < 4; i++)
+                if (masks[i] != 0)
+                    rows[y + 1 - i] |= masks[i];
+
+            return true;
+        }
+
+        // Removes the full rows, the rows above them move down. Returns the number of removed rows.
+        static int ClearFullRows(uint64_t* rows, int rowCount, int cols)
+        {
+            uint64_t full = GetFullRow(cols);
+            int to = 0;
+
+            for (int y = 0; y < rowCount; y++)
+            {
+                if (rows[y] != full)
+                    rows[to++] = rows[y];
+            }
+
+            int cleared = rowCount - to;
+            while (to < rowCount)
+                rows[to++] = 0;
+
+            return cleared;
+        }
+
+        // Computes the features of the board from scratch. The column heights are also returned if heights is not NULL.
+        static void Compute(const uint64_t* rows, int rowCount, int cols, BoardFeatures& features, int* heights = NULL)
+        {
+            uint64_t full = GetFullRow(cols);
+            int colHeights[MaxColumns];
+
+            int top = rowCount;
+            while (top > 0 && rows[top - 1] == 0)
+                top--;
+
+            features = BoardFeatures();
+            features.MaxHeight = top;
+
+            for (int x = 0; x < cols; x++)
+                colHeights[x] = 0;
+
+            // Top-down: a cell is a hole when an occupied cell of its column is above it
+            uint64_t covered = 0;
+            for (int y = top - 1; y >= 0; y--)
+            {
+                uint64_t row = rows[y];
+
+                features.Holes += PopCount(~row & covered & full);
+
+                for (uint64_t newTop = row & ~covered; newTop != 0; newTop &= newTop - 1)
+                    colHeights[LowestBit(newTop)] = y + 1;
+                covered |= row;
+
+                // A cell differs from its right neighbour where the row differs from itself shifted by one,
+                // and the walls count as occupied
+                if (row != 0)
+                {
+                    features.RowTransitions += PopCount((row ^ (row >> 1)) & (full >> 1));
+                    features.RowTransitions += (row & 1) == 0 ? 1 : 0;
+                    features.RowTransitions += ((row >> (cols - 1)) & 1) == 0 ? 1 : 0;
+                }
+
+                uint64_t below = y > 0 ? rows[y - 1] : full;
+                features.ColumnTransitions += PopCount((row ^ below) & full);
+            }
+
+            // The step from the top of every column to the empty cell above it
+            uint64_t topRow = top > 0 ? rows[top - 1] : full;
+            features.ColumnTransitions += top < rowCount ? PopCount(topRow & full) : 0;
+
+            for (int x = 0; x < cols; x++)
+            {
+                features.AggregateHeight += colHeights[x];
+                if (x < cols - 1)
+                    features.Bumpiness += abs(colHeights[x] - colHeights[x + 1]);
+                features.WellDepth += BoardFeatures::GetWellDepth(colHeights, cols, rowCount, x);
+            }
+
+            if (heights != NULL)
+            {
+                for (int x = 0; x < cols; x++)
+                    heights[x] = colHeights[x];
+            }
+        }
+
+    protected:
+        static int LowestBit(uint64_t v)
+        {
+#ifdef _MSC_VER
+            unsigned long index;
+            _BitScanForward64(&index, v);
+            return (int)index;
+#else
+            return __builtin_ctzll(v);
+#endif
+        }
+    };
+
+    /// <summary>
+    /// Playfield which keeps its features up to date while blocks are placed and rows are cleared, so reading them
+    /// costs nothing. Placing a block updates only the columns and rows it touches, and clearing a complete row
+    /// updates every column in constant time.
+    /// After writing Map directly, call RecalculateHeight and then RecalculateFeatures.
+    /// </summary>
+    class FeaturePlayfield : public Playfield
+    {
+    public:
+        FeaturePlayfield(Host* pHost, int rows, int cols) : Playfield(pHost, rows, cols)
+        {
+            m_ColumnHeights.assign(m_Columns, 0);
+            m_ColumnHoles.assign(m_Columns, 0);
+            m_ColumnTransitions.assign(m_Columns, 0);
+            m_BumpTerms.assign(m_Columns, 0);
+            m_WellTerms.assign(m_Columns, 0);
+            m_RowTransitions.assign(m_Rows, 0);
+            m_Recalculate.assign(m_Columns, false);
+
+            RecalculateFeatures();
+        }
+
+        const BoardFeatures& GetFeatures() const { return m_Features; }
+        int GetColumnHeight(int x) const { return m_ColumnHeights[x]; }
+        int GetColumnHoles(int x) const { return m_ColumnHoles[x]; }
+        int GetWellDepth(int x) const { return m_WellTerms[x]; }
+
+        // Computes every feature from scratch
+        void RecalculateFeatures()
+        {
+            m_Features = BoardFeatures();
+
+            for (int x = 0; x < m_Columns; x++)
+            {
+                UpdateColumn(x);
+                m_Features.AggregateHeight += m_ColumnHeights[x];
+                m_Features.Holes += m_ColumnHoles[x];
+                m_Features.ColumnTransitions += m_ColumnTransitions[x];
+            }
+
+            for (int y = 0; y < m_Rows; y++)
+            {
+                m_RowTransitions[y] = y < m_Height ? CountRowTransitions(y) : 0;
+                m_Features.RowTransitions += m_RowTransitions[y];
+            }
+
+            for (int x = 0; x < m_Columns; x++)
+            {
+                m_BumpTerms[x] = GetBumpTerm(x);
+                m_WellTerms[x] = BoardFeatures::GetWellDepth(m_ColumnHeights.data(), m_Columns, m_Rows, x);
+                m_Features.Bumpiness += m_BumpTerms[x];
+                m_Features.WellDepth += m_WellTerms[x];
+            }
+
+            m_Features.MaxHeight = m_Height;
+        }
+
+        void Occupy(const Block* pBlock) override
+        {
+            Playfield::Occupy(pBlock);
+
+            const byte* bmp = pBlock->GetCurrentBitmap();
+            byte columns = 0;
+
+            for (int i = 0; i < 4; i++)
+            {
+                int yy = pBlock->Y + 1 - i;
+                if (bmp[i] != 0 && yy >= 0 && yy < m_Rows)
+                {
+                    columns |= bmp[i];
+                    SetRowTransitions(yy, CountRowTransitions(yy));
+                }
+            }
+
+            for (int k = 0; k < 4; k++)
+            {
+                if ((columns & (0x8 >> k)) != 0)
+                    ReplaceColumn(pBlock->X - 2 + k);
+            }
+
+            for (int k = -1; k < 5; k++)
+                UpdateNeighbourTerms(pBlock->X - 2 + k);
+
+            m_Features.MaxHeight = m_Height;
+        }
+
+        void SetCell(int x, int y, byte color) override
+        {
+            Playfield::SetCell(x, y, color);
+
+            // Keeps the stack height exact, it is the maximum height
+            while (m_Height > 0 && IsRowEmpty(m_Height - 1))
+                m_Height--;
+
+            SetRowTransitions(y, CountRowTransitions(y));
+            ReplaceColumn(x);
+            for (int k = x - 1; k <= x + 1; k++)
+                UpdateNeighbourTerms(k);
+
+            m_Features.MaxHeight = m_Height;
+        }
+
+        void CopyFrom(const Playfield& other) override
+        {
+            Playfield::CopyFrom(other);
+
+            // The height of the other playfield may be only an upper bound
+            while (m_Height > 0 && IsRowEmpty(m_Height - 1))
+                m_Height--;
+
+            RecalculateFeatures();
+        }
+
+        void Clear() override
+        {
+            Playfield::Clear();
+            RecalculateFeatures();
+        }
+
+        void ClearRow(int y) override
+        {
+            if (y < 0 || y >= m_Height)
+            {
+                Playfield::ClearRow(y);
+                return;
+            }
+
+            bool isRowFull = true;
+            for (int x = 0; x < m_Columns && isRowFull; x++)
+                isRowFull = Map[y][x] != 0;
+
+            if (!isRowFull)
+            {
+                Playfield::ClearRow(y);
+                RecalculateFeatures();
+                return;
+            }
+
+            // Every column loses an occupied cell at y. Where it was not the top cell, the height drops by one
+            // and the holes stay, and the height differences (bumpiness and wells) do not change either. The other
+            // columns are scanned again after the shift.
+            for (int x = 0; x < m_Columns; x++)
+            {
+                m_Recalculate[x] = m_ColumnHeights[x] == y + 1 || m_ColumnHeights[x] >= m_Rows;
+                if (m_Recalculate[x])
+                    continue;
+
+                bool below = y > 0 ? Map[y - 1][x] != 0 : true;
+                bool above = Map[y + 1][x] != 0;
+                int delta = (below != above ? 1 : 0) - (below ? 0 : 1) - (above ? 0 : 1);
+
+                m_ColumnTransitions[x] += delta;
+                m_Features.ColumnTransitions += delta;
+                m_ColumnHeights[x]--;
+                m_Features.AggregateHeight--;
+            }
+
+            m_Features.RowTransitions -= m_RowTransitions[y];
+
+            int oldHeight = m_Height;
+            Playfield::ClearRow(y);
+
+            for (int i = y; i < oldHeight - 1; i++)
+                m_RowTransitions[i] = m_RowTransitions[i + 1];
+            m_RowTransitions[oldHeight - 1] = 0;
+
+            for (int x = 0; x < m_Columns; x++)
+            {
+                if (m_Recalculate[x])
+                    ReplaceColumn(x);
+            }
+
+            for (int x = 0; x < m_Columns; x++)
+            {
+                if (m_Recalculate[x] || (x > 0 && m_Recalculate[x - 1]) || (x < m_Columns - 1 && m_Recalculate[x + 1]))
+                    UpdateNeighbourTerms(x);
+            }
+
+            m_Features.MaxHeight = m_Height;
+        }
+
+    protected:
+        BoardFeatures m_Features;
+        std::vector<int> m_ColumnHeights;
+        std::vector<int> m_ColumnHoles;
+        std::vector<int> m_ColumnTransitions;
+        std::vector<int> m_BumpTerms;           // |height(x) - height(x + 1)|
+        std::vector<int> m_WellTerms;
+        std::vector<int> m_RowTransitions;
+        std::vector<bool> m_Recalculate;        // columns to scan again after a row clear
+
+        // Scans the column up to the stack height
+        void UpdateColumn(int x)
+        {
+            int height = 0;
+            int holes = 0;
+            int transitions = 0;
+            bool prev = true;   // the floor
+
+            for (int y = 0; y < m_Height; y++)
+            {
+                bool occupied = Map[y][x] != 0;
+                if (occupied)
+                {
+                    holes += y - height;
+                    height = y + 1;
+                }
+                if (occupied != prev)
+                    transitions++;
+                prev = occupied;
+            }
+
+            if (m_Height < m_Rows && prev)
+                transitions++;
+
+            m_ColumnHeights[x] = height;
+            m_ColumnHoles[x] = holes;
+            m_ColumnTransitions[x] = transitions;
+        }
+
+        // Updates the column features and their totals
+        void ReplaceColumn(int x)
+        {
+            if (x < 0 || x >= m_Columns)
+                return;
+
+            m_Features.AggregateHeight -= m_ColumnHeights[x];
+            m_Features.Holes -= m_ColumnHoles[x];
+            m_Features.ColumnTransitions -= m_ColumnTransitions[x];
+
+            UpdateColumn(x);
+
+            m_Features.AggregateHeight += m_ColumnHeights[x];
+            m_Features.Holes += m_ColumnHoles[x];
+            m_Features.ColumnTransitions += m_ColumnTransitions[x];
+        }
+
+        int GetBumpTerm(int x) const
+        {
+            return x < m_Columns - 1 ? abs(m_ColumnHeights[x] - m_ColumnHeights[x + 1]) : 0;
+        }
+
+        // Updates the bumpiness and well terms of the specified column after a height change
+        void UpdateNeighbourTerms(int x)
+        {
+            if (x < 0 || x >= m_Columns)
+                return;
+
+            int bump = GetBumpTerm(x);
+            int well = BoardFeatures::GetWellDepth(m_ColumnHeights.data(), m_Columns, m_Rows, x);
+
+            m_Features.Bumpiness += bump - m_BumpTerms[x];
+            m_Features.WellDepth += well - m_WellTerms[x];
+            m_BumpTerms[x] = bump;
+            m_WellTerms[x] = well;
+        }
+
+        // Empty rows have no transitions
+        int CountRowTransitions(int y) const
+        {
+            if (IsRowEmpty(y))
+                return 0;
+
+            int transitions = 0;
+            bool prev = true;   // the left wall
+
+            for (int x = 0; x < m_Columns; x++)
+            {
+                bool occupied = Map[y][x] != 0;
+                if (occupied != prev)
+                    transitions++;
+                prev = occupied;
+            }
+
+            return prev ? transitions : transitions + 1;    // the right wall
+        }
+
+        void SetRowTransitions(int y, int transitions)
+        {
+            m_Features.RowTransitions += transitions - m_RowTransitions[y];
+            m_RowTransitions[y] = transitions;
+        }
+    };
+}
+
+#endif
@@ -0,0 +1,363 @@
+/*
+    Nanochord.Tetris
+
+    Playfield with compile-time dimensions and inline storage: a row mask of the smallest sufficient integer type
+    (or of several 64-bit words on wide boards) per row for the collision tests and constant loop bounds everywhere
+
+    MIT License - see Tetris.h for details.
+ */
+
+#ifndef _Nanochord_TetrisFixed_
+#define _Nanochord_TetrisFixed_
+
+#include "Tetris.h"
+#include <array>
+#include <stdint.h>
+#include <string.h>
+#include <type_traits>
+
+namespace Nanochord
+{
+    /// <summary>
+    /// Row of a wide board as 64-bit words, bit x % 64 of Bits[x / 64] belongs to column x
+    /// </summary>
+    template <int WordCount>
+    struct WideRowMask
+    {
+        uint64_t Bits[WordCount];
+    };
+
+    /// <summary>
+    /// Occupancy mask of a row of Cols columns and the operations FixedPlayfield needs. Up to 64 columns the mask is
+    /// the smallest unsigned integer type with a bit for every column: uint16_t up to 16 columns, uint32_t up to 32
+    /// and uint64_t up to 64. Bit x belongs to column x.
+    /// Bitmap rows are passed reversed (see FixedPlayfield::ReverseBitmapRow), so bit k is the column first + k.
+    /// </summary>
+    template <int Cols, bool Wide = (Cols > 64)>
+    struct FixedRowMask
+    {
+        typedef typename std::conditional<(Cols <= 16), uint16_t,
+            typename std::conditional<(Cols <= 32), uint32_t, uint64_t>::type>::type Type;
+
+        static const Type Full = (Type)((Type)~(Type)0 >> (8 * sizeof(Type) - Cols));
+
+        static bool IsFull(const Type& row) { return row == Full; }
+        static bool IsEmpty(const Type& row) { return row == 0; }
+        static bool Test(const Type& row, int x) { return (row & ((Type)1 << x)) != 0; }
+        static void Set(Type& row, int x) { row |= (Type)((Type)1 << x); }
+        static void Reset(Type& row, int x) { row &= (Type)~((Type)1 << x); }
+
+        // Tells whether the reversed bitmap row at the column first overlaps the row. The bitmap row must be
+        // inside the board, first can be negative if its low bits are empty.
+        static bool Overlaps(const Type& row, byte reversedBits, int first)
+        {
+            Type mask = first >= 0 ? (Type)((Type)reversedBits << first) : (Type)(reversedBits >> -first);
+            return (row & mask) != 0;
+        }
+    };
+
+    /// <summary>
+    /// Occupancy mask of a row of more than 64 columns (e.g. 128 or 256) as WideRowMask. A bitmap row covers at most
+    /// two neighbouring words, so a placement test reads one or two words per bitmap row instead of the whole row;
+    /// the loops over every word have constant bounds and are unrolled or vectorized by the compiler.
+    /// </summary>
+    template <int Cols>
+    struct FixedRowMask<Cols, true>
+    {
+        static const int WordCount = (Cols + 63) / 64;
+        typedef WideRowMask<WordCount> Type;
+
+        static bool IsFull(const Type& row)
+        {
+            uint64_t missing = row.Bits[WordCount - 1] ^ (~0ULL >> (64 * WordCount - Cols));
+            for (int i = 0; i < WordCount - 1; i++)
+                missing |= ~row.Bits[i];
+
+            return missing == 0;
+        }
+
+        static bool IsEmpty(const Type& row)
+        {
+            uint64_t any = 0;
+            for (int i = 0; i < WordCount; i++)
+                any |= row.Bits[i];
+
+            return any == 0;
+        }
+
+        static bool Test(const Type& row, int x) { return (row.Bits[x >> 6] & (1ULL << (x & 63))) != 0; }
+        static void Set(Type& row, int x) { row.Bits[x >> 6] |= 1ULL << (x & 63); }
+        static void Reset(Type& row, int x) { row.Bits[x >> 6] &= ~(1ULL << (x & 63)); }
+
+        static bool Overlaps(const Type& row, byte reversedBits, int first)
+        {
+            uint64_t mask = reversedBits;
+            if (first < 0)
+            {
+                mask >>= -first;
+                first = 0;
+            }
+
+            // The part above bit 63 of the word belongs to the next word, which exists if the part is not empty
+            int word = first >> 6;
+            int shift = first & 63;
+            if ((row.Bits[word] & (mask << shift)) != 0)
+                return true;
+
+            return shift > 60 && (mask >> (64 - shift)) != 0 && (row.Bits[word + 1] & (mask >> (64 - shift))) != 0;
+        }
+    };
+
+    /// <summary>
+    /// Playfield with the dimensions given at compile time. The colors are stored inline in a std::array and every
+    /// row has an occupancy mask of FixedRowMask, so a placement test is at most four AND operations and a completed
+    /// row is a single comparison. The object does not allocate; a whole game can live on the stack or in static
+    /// memory (see FixedTetris). Map is NULL, so hosts have to use GetCell.
+    /// </summary>
+    template <int Rows, int Cols>
+    class FixedPlayfield : public Playfield
+    {
+        static_assert(Rows >= 10 && Cols >= 10, "The playfield is at least 10x10");
+
+        typedef FixedRowMask<Cols> Mask;
+
+    public:
+        typedef typename Mask::Type RowMask;
+
+        FixedPlayfield(Host* pHost) : Playfield(pHost, Rows, Cols, NULL)
+        {
+            memset(m_Cells.data(), 0, sizeof(m_Cells));
+            m_Masks.fill(RowMask());
+        }
+
+        // The playfield is referenced by its game, it is not copied; use CopyFrom
+        FixedPlayfield(const FixedPlayfield&) = delete;
+        FixedPlayfield& operator=(const FixedPlayfield&) = delete;
+
+        // Returns the occupancy mask of the specified row
+        const RowMask& GetRowMask(int y) const { return m_Masks[y]; }
+
+        byte GetCell(int x, int y) const override
+        {
+            return m_Cells[y][x];
+        }
+
+        bool IsRowEmpty(int y) const override
+        {
+            return Mask::IsEmpty(m_Masks[y]);
+        }
+
+        bool IsRowFull(int y) const override
+        {
+            return Mask::IsFull(m_Masks[y]);
+        }
+
+        void SetCell(int x, int y, byte color) override
+        {
+            m_Cells[y][x] = color;
+
+            if (color != 0)
+                Mask::Set(m_Masks[y], x);
+            else
+                Mask::Reset(m_Masks[y], x);
+
+            AddDamage(y, y + 1);
+
+            if (color != 0 && y >= m_Height)
+                m_Height = y + 1;
+        }
+
+        PlacementTestResult PlacementTest(const byte* bitmap, int x, int y) override
+        {
+            if (bitmap == NULL)
+                return PlacementTestResult::Error;
+
+            // A block which sticks out of the playfield goes through the cell by cell test, which reports the side
+            byte cols = bitmap[0] | bitmap[1] | bitmap[2] | bitmap[3];
+            int bottom = bitmap[3] != 0 ? 3 : bitmap[2] != 0 ? 2 : bitmap[1] != 0 ? 1 : 0;
+            if (cols == 0 || x - 2 + FirstColumn(cols) < 0 || x - 2 + LastColumn(cols) > Cols - 1 || y + 1 - bottom < 0)
+                return Playfield::PlacementTest(bitmap, x, y);
+
+            TETRIS_STAT_INC(Stats, PlacementTests);
+
+            for (int i = 0; i < 4; i++)
+            {
+                int yy = y + 1 - i;
+                if (bitmap[i] != 0 && yy < m_Height && Mask::Overlaps(m_Masks[yy], ReverseBitmapRow(bitmap[i]), x - 2))
+                    return PlacementTestResult::Failed;
+            }
+
+            return PlacementTestResult::Succeeded;
+        }
+
+        void Occupy(const Block* pBlock) override
+        {
+            const byte* currBmp = pBlock->GetCurrentBitmap();
+
+            TETRIS_STAT_INC(Stats, Locks);
+
+            for (int i = 0; i < 4; i++)
+            {
+                int yy = pBlock->Y + 1 - i;
+
+                if (yy >= 0 && yy < Rows && currBmp[i] != 0)
+                {
+                    for (int k = 0; k < 4; k++)
+                    {
+                        if ((currBmp[i] & (0x8 >> k)) != 0)
+                            SetCell(pBlock->X - 2 + k, yy, pBlock->Color);
+                    }
+                }
+            }
+        }
+
+        int GetCompletedRows() override
+        {
+            TETRIS_TRACE_SCOPE("GetCompletedRows");
+
+            int cnt = 0;
+
+            for (int y = m_Height - 1; y >= 0 && cnt < 4; y--)
+            {
+                if (Mask::IsFull(m_Masks[y]))
+                {
+                    CompletedLines[cnt] = y;
+                    cnt++;
+                }
+            }
+
+            return cnt;
+        }
+
+        void Clear() override
+        {
+            for (int y = 0; y < m_Height; y++)
+            {
+                m_Cells[y].fill(0);
+                m_Masks[y] = RowMask();
+            }
+
+            AddDamage(0, m_Height);
+            m_Height = 0;
+        }
+
+        void ClearRow(int y) override
+        {
+            TETRIS_STAT_INC(Stats, RowsCleared);
+
+            if (y < 0 || y >= m_Height)
+                return;
+
+            // Only the occupied rows move down
+            memmove(&m_Cells[y], &m_Cells[y + 1], (m_Height - 1 - y) * sizeof(m_Cells[0]));
+            memmove(&m_Masks[y], &m_Masks[y + 1], (m_Height - 1 - y) * sizeof(RowMask));
+            m_Cells[m_Height - 1].fill(0);
+            m_Masks[m_Height - 1] = RowMask();
+
+            AddDamage(y, m_Height);
+            m_Height--;
+        }
+
+        void CopyFrom(const Playfield& other) override
+        {
+            const FixedPlayfield* pOther = dynamic_cast<const FixedPlayfield*>(&other);
+            if (pOther == NULL)
+            {
+                Clear();
+
+                for (int y = 0; y < other.GetHeight(); y++)
+                {
+                    for (int x = 0; x < Cols; x++)
+                    {
+                        byte color = other.GetCell(x, y);
+                        if (color != 0)
+                            SetCell(x, y, color);
+                    }
+                }
+
+                return;
+            }
+
+            // The rows above both stacks are empty in both playfields
+            int height = m_Height > pOther->m_Height ? m_Height : pOther->m_Height;
+            memcpy(m_Cells.data(), pOther->m_Cells.data(), height * sizeof(m_Cells[0]));
+            memcpy(m_Masks.data(), pOther->m_Masks.data(), height * sizeof(RowMask));
+
+            AddDamage(0, height);
+            m_Height = pOther->m_Height;
+        }
+
+        void Dump() override
+        {
+            if (m_pHost != NULL)
+            {
+                for (int i = 0; i < Rows; i++)
+                {
+                    for (int j = 0; j < Cols; j++)
+                    {
+                        TETRIS_STAT_HOST_CALL(Stats, CallPrint);
+                        m_pHost->Print(m_Cells[i][j] == 0 ? "0" : "1");
+                    }
+                    TETRIS_STAT_HOST_CALL(Stats, CallPrint);
+                    m_pHost->Print("\r\n");
+                }
+            }
+        }
+
+        PlacementTestResult IsPositionEmpty(int xx, int yy) override
+        {
+            if (xx < 0)
+                return PlacementTestResult::StickoutLeft;
+            if (xx > Cols - 1)
+                return PlacementTestResult::StickoutRight;
+            if (yy < 0)
+                return PlacementTestResult::Failed;
+            if (yy >= m_Height)
+                return PlacementTestResult::Succeeded;
+
+            return Mask::Test(m_Masks[yy], xx) ? PlacementTestResult::Failed : PlacementTestResult::Succeeded;
+        }
+
+    protected:
+        std::array<std::array<byte, Cols>, Rows> m_Cells;
+        std::array<RowMask, Rows> m_Masks;
+
+        // Columns of a bitmap row: bit 0x8 is the column x - 2 and bit 0x1 is x + 1
+        static int FirstColumn(byte bits)
+        {
+            return (bits & 0x8) != 0 ? 0 : (bits & 0x4) != 0 ? 1 : (bits & 0x2) != 0 ? 2 : 3;
+        }
+
+        static int LastColumn(byte bits)
+        {
+            return (bits & 0x1) != 0 ? 3 : (bits & 0x2) != 0 ? 2 : (bits & 0x4) != 0 ? 1 : 0;
+        }
+
+        // Reverses the bits of a bitmap row, so bit k is the column x - 2 + k like in the row masks
+        static byte ReverseBitmapRow(byte bits)
+        {
+            static const byte Reversed[16] = { 0, 8, 4, 12, 2, 10, 6, 14, 1, 9, 5, 13, 3, 11, 7, 15 };
+            return Reversed[bits & 0x0F];
+        }
+    };
+
+    /// <summary>
+    /// Game on a FixedPlayfield which is a member of the game, so the whole game is a single object without heap
+    /// allocated cells, e.g. a local variable or a global. Only the two falling blocks are allocated.
+    /// </summary>
+    template <int Rows, int Cols>
+    class FixedTetris : public Tetris
+    {
+    public:
+        FixedTetris(Host* pHost) : Tetris(pHost, &m_FixedPlayfield), m_FixedPlayfield(pHost)
+        {
+        }
+
+        FixedPlayfield<Rows, Cols>& GetFixedPlayfield() { return m_FixedPlayfield; }
+
+    protected:
+        FixedPlayfield<Rows, Cols> m_FixedPlayfield;    // constructed after the Tetris base, which only stores its address
+    };
+}
+
+#endif
@@ -0,0 +1,174 @@
+/*
+    Nanochord.Tetris
+
+    Incremental 64-bit hash of the game state for lockstep desync detection and replay verification
+
+    MIT License - see Tetris.h for details.
+
+    The hash is maintained only when TETRIS_STATE_HASH is defined before including Tetris.h. Tetris::GetStateHash
+    then combines the hash of the playfield, which is updated at every touchdown and cleared row, with the falling
+    blocks, the counters and the random numbers drawn so far, so comparing it every tick costs a few multiplications.
+ */
+
+#ifndef _Nanochord_TetrisHash_
+#define _Nanochord_TetrisHash_
+
+#include <stdint.h>
+#include <string.h>
+
+namespace Nanochord
+{
+    /// <summary>
+    /// Hash of the cells of a playfield which follows the changes instead of reading the cells. Every occupied cell
+    /// has a key made from its column and color, the key of a row is the sum of its cell keys, and the hash is the
+    /// sum of the row keys multiplied by Base^y. Occupying a cell adds one term; removing a row sums the rows below
+    /// it and multiplies the rows above it by the inverse of Base; inserting a row at the bottom multiplies the whole
+    /// hash by Base.
+    /// </summary>
+    class BoardHash
+    {
+    public:
+        static const uint64_t Base = 0x9E3779B97F4A7C15ULL;     // odd, so it has an inverse modulo 2^64
+
+        BoardHash()
+        {
+            m_pRowKeys = NULL;
+            m_Rows = 0;
+            m_Hash = 0;
+        }
+
+        ~BoardHash()
+        {
+            delete[] m_pRowKeys;
+        }
+
+        // Allocates the row keys for the specified number of rows and empties the hash
+        void Init(int rows)
+        {
+            if (rows != m_Rows)
+            {
+                delete[] m_pRowKeys;
+                m_pRowKeys = new uint64_t[rows];
+                m_Rows = rows;
+            }
+
+            Reset();
+        }
+
+        // The hash of an empty playfield
+        void Reset()
+        {
+            if (m_pRowKeys != NULL)
+                memset(m_pRowKeys, 0, m_Rows * sizeof(uint64_t));
+            m_Hash = 0;
+        }
+
+        uint64_t Get() const { return m_Hash; }
+
+        void CopyFrom(const BoardHash& other)
+        {
+            if (other.m_Rows != m_Rows)
+                Init(other.m_Rows);
+
+            if (m_Rows > 0)
+                memcpy(m_pRowKeys, other.m_pRowKeys, m_Rows * sizeof(uint64_t));
+            m_Hash = other.m_Hash;
+        }
+
+        // Adds an occupied cell, which was empty
+        void AddCell(int x, int y, unsigned char color)
+        {
+            if (y < 0 || y >= m_Rows || color == 0)
+                return;
+
+            uint64_t key = GetCellKey(x, color);
+            m_pRowKeys[y] += key;
+            m_Hash += key * Power(y);
+        }
+
+        // Removes the row y, the rows above it move down
+        void RemoveRow(int y)
+        {
+            if (y < 0 || y >= m_Rows)
+                return;
+
+            uint64_t below = 0;
+            uint64_t power = 1;
+            for (int i = 0; i < y; i++)
+            {
+                below += m_pRowKeys[i] * power;
+                power *= Base;
+            }
+
+            uint64_t above = m_Hash - below - m_pRowKeys[y] * power;
+            m_Hash = below + above * GetInverse();
+
+            memmove(m_pRowKeys + y, m_pRowKeys + y + 1, (m_Rows - y - 1) * sizeof(uint64_t));
+            m_pRowKeys[m_Rows - 1] = 0;
+        }
+
+        // Inserts a row with the specified key (see GetRowKey) at the bottom, the other rows move up. The top row
+        // has to be empty.
+        void InsertRow(uint64_t rowKey)
+        {
+            if (m_Rows == 0)
+                return;
+
+            m_Hash = m_Hash * Base + rowKey;
+
+            memmove(m_pRowKeys + 1, m_pRowKeys, (m_Rows - 1) * sizeof(uint64_t));
+            m_pRowKeys[0] = rowKey;
+        }
+
+        // splitmix64 finalizer
+        static uint64_t Mix(uint64_t v)
+        {
+            v = (v ^ (v >> 30)) * 0xBF58476D1CE4E5B9ULL;
+            v = (v ^ (v >> 27)) * 0x94D049BB133111EBULL;
+            return v ^ (v >> 31);
+        }
+
+        static uint64_t GetCellKey(int x, unsigned char color)
+        {
+            return color == 0 ? 0 : Mix(((uint64_t)x << 8) + color + 1);
+        }
+
+        // Returns the key of a row of cells (a byte per cell, 0 means empty)
+        static uint64_t GetRowKey(const unsigned char* pRow, int cols)
+        {
+            uint64_t key = 0;
+            for (int x = 0; x < cols; x++)
+                key += GetCellKey(x, pRow[x]);
+            return key;
+        }
+
+    protected:
+        uint64_t* m_pRowKeys;
+        int m_Rows;
+        uint64_t m_Hash;
+
+        static uint64_t Power(int y)
+        {
+            uint64_t result = 1;
+            uint64_t base = Base;
+            for (; y > 0; y >>= 1)
+            {
+                if ((y & 1) != 0)
+                    result *= base;
+                base *= base;
+            }
+            return result;
+        }
+
+        // The inverse of Base modulo 2^64 with Newton's iteration, every step doubles the correct low bits
+        static uint64_t GetInverse()
+        {
+            uint64_t inverse = Base;
+            for (int i = 0; i < 5; i++)
+                inverse *= 2 - Base * inverse;
+            return inverse;
+        }
+    };
+}
+
+#endif
@@ -0,0 +1,67 @@
+/*
+    Nanochord.Tetris
+
+    Headless host for running games without any output (benchmarks, bots, simulations)
+
+    MIT License - see Tetris.h for details.
+ */
+
+#ifndef _Nanochord_TetrisHeadless_
+#define _Nanochord_TetrisHeadless_
+
+#include "Tetris.h"
+#include <stdint.h>
+
+namespace Nanochord
+{
+    /// <summary>
+    /// Host implementation which draws nothing and generates reproducible random numbers from a seed
+    /// </summary>
+    class HeadlessHost : public Host
+    {
+    public:
+        HeadlessHost(uint64_t seed = 1)
+        {
+            Seed(seed);
+        }
+
+        // Restarts the random sequence from the specified seed
+        void Seed(uint64_t seed)
+        {
+            // splitmix64 step, so that small or similar seeds give unrelated sequences
+            uint64_t z = seed + 0x9E3779B97F4A7C15ULL;
+            z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+            z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+            m_RandomState = (z ^ (z >> 31)) | 1;
+        }
+
+        uint64_t GetRandomState() const { return m_RandomState; }
+        void SetRandomState(uint64_t state) { m_RandomState = state; }
+
+        // Host interface
+
+        void ClearBackground() override {}
+        void DrawBlock(const Block* pBlock) override {}
+        void DrawNextBlock(const Block* pBlock) override {}
+        void ClearBlock(const Block* pBlock) override {}
+        void PaintPlayground(const Playfield* pPlayfield) override {}
+        void Print(const char* text) override {}
+        void TetrisEvent(TetrisEventKind kind) override {}
+
+        int Random(int max) override
+        {
+            // xorshift64*
+            m_RandomState ^= m_RandomState >> 12;
+            m_RandomState ^= m_RandomState << 25;
+            m_RandomState ^= m_RandomState >> 27;
+            uint64_t r = m_RandomState * 0x2545F4914F6CDD1DULL;
+
+            return max > 0 ? (int)((r >> 32) % (uint64_t)max) : 0;
+        }
+
+    protected:
+        uint64_t m_RandomState;
+    };
+}
+
+#endif
@@ -0,0 +1,292 @@
+/*
+    Nanochord.Tetris
+
+    Playfield for very large boards with sparse, chunked row storage
+
+    MIT License - see Tetris.h for details.
+ */
+
+#ifndef _Nanochord_TetrisLarge_
+#define _Nanochord_TetrisLarge_
+
+#include "Tetris.h"
+#include <string.h>
+#include <vector>
+
+namespace Nanochord
+{
+    /// <summary>
+    /// Playfield for boards of any size (e.g. 512x100000). Rows are stored in chunks which are allocated only when
+    /// one of their rows gets occupied and freed when the stack shrinks below them again. The number of occupied
+    /// cells is kept per row, so complete rows are found without scanning the cells, and the stack height is exact,
+    /// so every scan stops at the highest occupied row.
+    /// Map is not available, use GetCell to read the content.
+    /// </summary>
+    class LargePlayfield : public Playfield
+    {
+    public:
+        static const int ChunkRows = 64;
+
+        LargePlayfield(Host* pHost, int rows, int cols) : Playfield(pHost, rows, cols, NULL)
+        {
+            m_Chunks.assign((m_Rows + ChunkRows - 1) / ChunkRows, (Chunk*)NULL);
+        }
+
+        ~LargePlayfield()
+        {
+            Clear();
+        }
+
+        // Returns the number of chunks currently allocated
+        int GetAllocatedChunks() const
+        {
+            int cnt = 0;
+            for (size_t i = 0; i < m_Chunks.size(); i++)
+                if (m_Chunks[i] != NULL)
+                    cnt++;
+            return cnt;
+        }
+
+        byte GetCell(int x, int y) const override
+        {
+            const byte* pRow = GetRow(y);
+            return pRow != NULL ? pRow[x] : 0;
+        }
+
+        bool IsRowEmpty(int y) const override
+        {
+            return GetRow(y) == NULL || GetRowCount(y) == 0;
+        }
+
+        bool IsRowFull(int y) const override
+        {
+            return GetRow(y) != NULL && GetRowCount(y) == m_Columns;
+        }
+
+        void SetCell(int x, int y, byte color) override
+        {
+            AddDamage(y, y + 1);
+
+            if (color == 0)
+            {
+                byte* pRow = GetRow(y);
+                if (pRow != NULL && pRow[x] != 0)
+                {
+                    pRow[x] = 0;
+                    if (--GetRowCount(y) == 0 && y == m_Height - 1)
+                        TrimHeight();
+                }
+                return;
+            }
+
+            byte* pRow = MaterializeRow(y);
+            if (pRow[x] == 0)
+                GetRowCount(y)++;
+            pRow[x] = color;
+
+            if (y >= m_Height)
+                m_Height = y + 1;
+        }
+
+        void Occupy(const Block* pBlock) override
+        {
+            const byte* currBmp = pBlock->GetCurrentBitmap();
+
+            TETRIS_STAT_INC(Stats, Locks);
+
+            for (int i = 0; i < 4; i++)
+            {
+                int yy = pBlock->Y + 1 - i;
+
+                if (yy >= 0 && yy < m_Rows && currBmp[i] != 0)
+                {
+                    if ((currBmp[i] & 0x8) != 0)
+                        SetCell(pBlock->X - 2, yy, pBlock->Color);
+
+                    if ((currBmp[i] & 0x4) != 0)
+                        SetCell(pBlock->X - 1, yy, pBlock->Color);
+
+                    if ((currBmp[i] & 0x2) != 0)
+                        SetCell(pBlock->X, yy, pBlock->Color);
+
+                    if ((currBmp[i] & 0x1) != 0)
+                        SetCell(pBlock->X + 1, yy, pBlock->Color);
+                }
+            }
+        }
+
+        int GetCompletedRows() override
+        {
+            TETRIS_TRACE_SCOPE("GetCompletedRows");
+
+            int cnt = 0;
+
+            for (int y = m_Height - 1; y >= 0 && cnt < 4; y--)
+            {
+                if (m_Chunks[y / ChunkRows] != NULL && GetRowCount(y) == m_Columns)
+                {
+                    CompletedLines[cnt] = y;
+                    cnt++;
+                }
+            }
+
+            return cnt;
+        }
+
+        void Clear() override
+        {
+            for (size_t i = 0; i < m_Chunks.size(); i++)
+            {
+                delete m_Chunks[i];
+                m_Chunks[i] = NULL;
+            }
+
+            AddDamage(0, m_Height);
+            m_Height = 0;
+        }
+
+        void CopyFrom(const Playfield& other) override
+        {
+            Clear();
+
+            for (int y = 0; y < other.GetHeight(); y++)
+            {
+                for (int x = 0; x < m_Columns; x++)
+                {
+                    byte color = other.GetCell(x, y);
+                    if (color != 0)
+                        SetCell(x, y, color);
+                }
+            }
+        }
+
+        void ClearRow(int y) override
+        {
+            TETRIS_STAT_INC(Stats, RowsCleared);
+
+            if (y < 0 || y >= m_Height)
+                return;
+
+            // Only the occupied region moves down
+            for (int i = y + 1; i < m_Height; i++)
+                CopyRow(i, i - 1);
+
+            EmptyRow(m_Height - 1);
+
+            AddDamage(y, m_Height);
+            TrimHeight();
+        }
+
+        void Dump() override
+        {
+            if (m_pHost != NULL)
+            {
+                for (int i = 0; i < m_Rows; i++)
+                {
+                    for (int j = 0; j < m_Columns; j++)
+                    {
+                        TETRIS_STAT_HOST_CALL(Stats, CallPrint);
+                        m_pHost->Print(GetCell(j, i) == 0 ? "0" : "1");
+                    }
+                    TETRIS_STAT_HOST_CALL(Stats, CallPrint);
+                    m_pHost->Print("\r\n");
+                }
+            }
+        }
+
+        PlacementTestResult IsPositionEmpty(int xx, int yy) override
+        {
+            if (xx < 0)
+                return PlacementTestResult::StickoutLeft;
+            if (xx > m_Columns - 1)
+                return PlacementTestResult::StickoutRight;
+            if (yy < 0)
+                return PlacementTestResult::Failed;
+            if (yy >= m_Height)
+                return PlacementTestResult::Succeeded;
+
+            const byte* pRow = GetRow(yy);
+            return pRow != NULL && pRow[xx] != 0 ? PlacementTestResult::Failed : PlacementTestResult::Succeeded;
+        }
+
+    protected:
+        // Lowers the stack height to the highest occupied row and gives back the chunks above it
+        void TrimHeight()
+        {
+            int oldHeight = m_Height;
+            while (m_Height > 0 && IsRowEmpty(m_Height - 1))
+                m_Height--;
+
+            for (int c = (m_Height + ChunkRows - 1) / ChunkRows; c <= (oldHeight - 1) / ChunkRows; c++)
+            {
+                delete m_Chunks[c];
+                m_Chunks[c] = NULL;
+            }
+        }
+
+        /// <summary>
+        /// ChunkRows consecutive rows and the number of occupied cells in each of them
+        /// </summary>
+        struct Chunk
+        {
+            Chunk(int cols) : Cells(ChunkRows * cols, 0)
+            {
+                memset(Counts, 0, sizeof(Counts));
+            }
+
+            std::vector<byte> Cells;
+            int Counts[ChunkRows];
+        };
+
+        std::vector<Chunk*> m_Chunks;
+
+        byte* GetRow(int y) const
+        {
+            Chunk* pChunk = m_Chunks[y / ChunkRows];
+            return pChunk != NULL ? &pChunk->Cells[(y % ChunkRows) * m_Columns] : NULL;
+        }
+
+        // Only valid for rows of allocated chunks
+        int& GetRowCount(int y) const
+        {
+            return m_Chunks[y / ChunkRows]->Counts[y % ChunkRows];
+        }
+
+        byte* MaterializeRow(int y)
+        {
+            Chunk*& pChunk = m_Chunks[y / ChunkRows];
+            if (pChunk == NULL)
+            {
+                pChunk = new Chunk(m_Columns);
+                TETRIS_STAT_INC(Stats, Allocations);
+            }
+
+            return &pChunk->Cells[(y % ChunkRows) * m_Columns];
+        }
+
+        void EmptyRow(int y)
+        {
+            byte* pRow = GetRow(y);
+            if (pRow != NULL)
+            {
+                memset(pRow, 0, m_Columns);
+                GetRowCount(y) = 0;
+            }
+        }
+
+        void CopyRow(int from, int to)
+        {
+            const byte* pFrom = GetRow(from);
+            if (pFrom == NULL)
+            {
+                EmptyRow(to);
+                return;
+            }
+
+            memcpy(MaterializeRow(to), pFrom, m_Columns);
+            GetRowCount(to) = GetRowCount(from);
+        }
+    };
+}
+
+#endif
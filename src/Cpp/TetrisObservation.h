@@ -0,0 +1,207 @@
+/*
+    Nanochord.Tetris
+
+    Observation buffer for machine learning: board, active block and next block planes written in place
+
+    MIT License - see Tetris.h for details.
+ */
+
+#ifndef _Nanochord_TetrisObservation_
+#define _Nanochord_TetrisObservation_
+
+#include "Tetris.h"
+#include <stddef.h>
+#include <string.h>
+
+namespace Nanochord
+{
+    /// <summary>
+    /// Memory layout of one observation. Every value is a byte, every offset and stride is in bytes from the start
+    /// of the observation. The planes are row-major with row 0 being the bottom row of the playfield.
+    /// </summary>
+    struct ObservationLayout
+    {
+        static const int BlockKindCount = 7;
+
+        int Rows;
+        int Columns;
+        size_t RowStride;           // distance of two rows in a plane
+        size_t PlaneSize;           // Rows * RowStride
+        size_t OccupancyOffset;     // 1 where the playfield is occupied
+        size_t ColorOffset;         // color of the playfield cells, only if HasColors
+        size_t BlockOffset;         // 1 where the active block is
+        size_t NextOffset;          // one-hot vector of BlockKindCount values, the kind of the next block
+        size_t Size;                // size of the whole observation
+        bool HasColors;
+
+        void Init(int rows, int cols, bool withColors)
+        {
+            Rows = rows;
+            Columns = cols;
+            RowStride = cols;
+            PlaneSize = rows * RowStride;
+            HasColors = withColors;
+
+            OccupancyOffset = 0;
+            ColorOffset = withColors ? PlaneSize : 0;
+            BlockOffset = (withColors ? 2 : 1) * PlaneSize;
+            NextOffset = BlockOffset + PlaneSize;
+            Size = NextOffset + BlockKindCount;
+        }
+    };
+
+    /// <summary>
+    /// Tetris game which keeps an observation buffer up to date after every tick and every player action.
+    /// Only the changed parts are written: the board planes up to the stack height and the cells of the active
+    /// block, so the buffer can be shared with a consumer (e.g. a numpy array) without copying it.
+    /// </summary>
+    class ObservationTetris : public Tetris
+    {
+    public:
+        ObservationTetris(Host* pHost, int rows, int cols, bool withColors = false) : Tetris(pHost, rows, cols)
+        {
+            InitObservation(withColors);
+        }
+
+        ObservationTetris(Host* pHost, Playfield* pPlayfield, bool withColors = false) : Tetris(pHost, pPlayfield)
+        {
+            InitObservation(withColors);
+        }
+
+        ~ObservationTetris()
+        {
+            delete[] m_pOwnedObservation;
+        }
+
+        const ObservationLayout& GetLayout() const { return m_Layout; }
+        byte* GetObservation() const { return m_pObservation; }
+
+        // Makes the game write its observation into the specified buffer of GetLayout().Size bytes, which must
+        // outlive the game. NULL makes the game use its own buffer again.
+        void SetObservationBuffer(byte* pBuffer)
+        {
+            m_pObservation = pBuffer != NULL ? pBuffer : m_pOwnedObservation;
+            memset(m_pObservation, 0, m_Layout.Size);
+            m_BoardHeight = m_Layout.Rows;
+            m_BlockCellCount = 0;
+            UpdateObservation();
+        }
+
+        int Start() override
+        {
+            int res = Tetris::Start();
+            UpdateObservation();
+            return res;
+        }
+
+        int Run() override
+        {
+            int res = Tetris::Run();
+            UpdateObservation();
+            return res;
+        }
+
+        void MoveLeft() override
+        {
+            Tetris::MoveLeft();
+            UpdateObservation();
+        }
+
+        void MoveRight() override
+        {
+            Tetris::MoveRight();
+            UpdateObservation();
+        }
+
+        void Rotate() override
+        {
+            Tetris::Rotate();
+            UpdateObservation();
+        }
+
+        int Drop() override
+        {
+            int res = Tetris::Drop();
+            UpdateObservation();
+            return res;
+        }
+
+    protected:
+        using Tetris::Run;
+
+        ObservationLayout m_Layout;
+        byte* m_pObservation;
+        byte* m_pOwnedObservation;
+        int m_BoardHeight;          // the board planes are empty at and above this row
+        int m_BlockCells[4];        // offsets of the active block cells in the block plane
+        int m_BlockCellCount;
+
+        void InitObservation(bool withColors)
+        {
+            m_Layout.Init(m_Playfield.GetRows(), m_Playfield.GetColumns(), withColors);
+            m_pOwnedObservation = new byte[m_Layout.Size];
+            m_pObservation = NULL;
+            SetObservationBuffer(NULL);
+        }
+
+        // Writes the changed parts of the game state into the observation buffer
+        virtual void UpdateObservation()
+        {
+            byte* pOccupancy = m_pObservation + m_Layout.OccupancyOffset;
+            byte* pColors = m_pObservation + m_Layout.ColorOffset;
+            byte* pBlock = m_pObservation + m_Layout.BlockOffset;
+            byte* pNext = m_pObservation + m_Layout.NextOffset;
+
+            // Board: the stack, and the rows above it which were occupied at the last update
+            int height = m_Playfield.GetHeight();
+            int rows = height > m_BoardHeight ? height : m_BoardHeight;
+            for (int y = 0; y < rows; y++)
+            {
+                size_t row = y * m_Layout.RowStride;
+                for (int x = 0; x < m_Layout.Columns; x++)
+                {
+                    byte color = y < height ? (m_Playfield.Map != NULL ? m_Playfield.Map[y][x] : m_Playfield.GetCell(x, y)) : 0;
+                    pOccupancy[row + x] = color != 0 ? 1 : 0;
+                    if (m_Layout.HasColors)
+                        pColors[row + x] = color;
+                }
+            }
+            m_BoardHeight = height;
+
+            // Active block: the previous cells are cleared, the current ones are set
+            for (int i = 0; i < m_BlockCellCount; i++)
+                pBlock[m_BlockCells[i]] = 0;
+            m_BlockCellCount = 0;
+
+            if (m_pCurrentBlock != NULL && !m_GameOver)
+            {
+                const byte* bmp = m_pCurrentBlock->GetCurrentBitmap();
+                for (int i = 0; i < 4; i++)
+                {
+                    int yy = m_pCurrentBlock->Y + 1 - i;
+                    if (yy < 0 || yy >= m_Layout.Rows)
+                        continue;
+
+                    for (int k = 0; k < 4; k++)
+                    {
+                        int xx = m_pCurrentBlock->X - 2 + k;
+                        if ((bmp[i] & (0x8 >> k)) != 0 && xx >= 0 && xx < m_Layout.Columns && m_BlockCellCount < 4)
+                        {
+                            int offs = (int)(yy * m_Layout.RowStride) + xx;
+                            pBlock[offs] = 1;
+                            m_BlockCells[m_BlockCellCount++] = offs;
+                        }
+                    }
+                }
+            }
+
+            // Next block, its kind is identified by its color (1-7)
+            for (int i = 0; i < ObservationLayout::BlockKindCount; i++)
+                pNext[i] = 0;
+            if (m_pNextBlock != NULL && m_pNextBlock->Color >= 1 && m_pNextBlock->Color <= ObservationLayout::BlockKindCount)
+                pNext[m_pNextBlock->Color - 1] = 1;
+        }
+    };
+}
+
+#endif
@@ -0,0 +1,319 @@
+/*
+    Nanochord.Tetris
+
+    Placement generator and perft (placement sequence counting) for validating and timing the collision code
+
+    MIT License - see Tetris.h for details.
+ */
+
+#ifndef _Nanochord_TetrisPerft_
+#define _Nanochord_TetrisPerft_
+
+#include "Tetris.h"
+#include "TetrisHeadless.h"
+#include <stdint.h>
+#include <vector>
+
+namespace Nanochord
+{
+    /// <summary>
+    /// Final pose of a block, where it gets locked
+    /// </summary>
+    struct Placement
+    {
+        int X;
+        int Y;
+        byte OriIndex;
+    };
+
+    /// <summary>
+    /// Generates every distinct placement of a block with the rules of the game: starting from the spawn pose the
+    /// block can be moved left and right, rotated (with the wall kicks of the RotationSystem of the playfield, see
+    /// Playfield::RotationTest) and moved down by one row, and it is locked where it cannot move down. Every test
+    /// goes through Playfield::PlacementTest, so the generator exercises the collision code of any playfield
+    /// implementation.
+    /// </summary>
+    class PlacementGenerator
+    {
+    public:
+        PlacementGenerator()
+        {
+            m_Width = 0;
+            m_Height = 0;
+            m_Generation = 0;
+        }
+
+        // Collects the placements of the block reachable from its current pose. Returns their number, which is 0 if
+        // the block cannot be placed at its current pose (game over).
+        int Generate(Playfield& playfield, const Block* pBlock, std::vector<Placement>& placements)
+        {
+            placements.clear();
+            m_Queue.clear();
+
+            // The reference point of a block can be 2 columns out of the playfield on both sides, and it can go 1
+            // row below the floor when the bottom row of the bitmap is empty. Kicks can lift a block above the top
+            // row while it still touches the stack.
+            const RotationSystem* pRotationSystem = playfield.GetRotationSystem();
+            int height = playfield.GetRows() + YMargin + 1 + pRotationSystem->GetMaxKickUp();
+            if (m_Width != playfield.GetColumns() + 2 * XMargin || m_Height != height)
+            {
+                m_Width = playfield.GetColumns() + 2 * XMargin;
+                m_Height = height;
+                m_Visited.assign(m_Width * m_Height * 4, 0);
+                m_Generation = 0;
+            }
+
+            if (++m_Generation == 0)
+            {
+                // The stamps wrapped around, the old ones must not match the new generations
+                m_Visited.assign(m_Visited.size(), 0);
+                m_Generation = 1;
+            }
+
+            if (playfield.PlacementTest(pBlock->GetCurrentBitmap(), pBlock->X, pBlock->Y) != PlacementTestResult::Succeeded)
+                return 0;
+
+            Push(pBlock->X, pBlock->Y, pBlock->OriIndex);
+            size_t first = 0;
+
+            // The rows above the stack are empty, so the block can take the same poses in each of them. The poses of
+            // the spawn row are moved down together to the lowest row where the block and its kicks are still above
+            // the stack.
+            int top = playfield.GetHeight() + 2 + pRotationSystem->GetMaxKickDown();
+            if (pBlock->Y > top)
+            {
+                for (size_t i = 0; i < m_Queue.size(); i++)
+                    Expand(playfield, pBlock, m_Queue[i], false, placements);
+
+                first = m_Queue.size();
+                for (size_t i = 0; i < first; i++)
+                    Push(m_Queue[i].X, top, m_Queue[i].OriIndex);
+            }
+
+            for (size_t i = first; i < m_Queue.size(); i++)
+                Expand(playfield, pBlock, m_Queue[i], true, placements);
+
+            return (int)placements.size();
+        }
+
+    protected:
+        static const int XMargin = 2;
+        static const int YMargin = 2;
+
+        int m_Width;
+        int m_Height;
+        std::vector<unsigned> m_Visited;    // generation stamp of every pose, a pose is visited in the current generation
+        unsigned m_Generation;
+        std::vector<Placement> m_Queue;
+
+        // Visits the poses reachable from the specified one in one move. A pose from which the block cannot move down
+        // is a placement.
+        void Expand(Playfield& playfield, const Block* pBlock, Placement pose, bool canMoveDown, std::vector<Placement>& placements)
+        {
+            const byte* bmp = pBlock->OriBitmaps[pose.OriIndex];
+
+            if (playfield.PlacementTest(bmp, pose.X - 1, pose.Y) == PlacementTestResult::Succeeded)
+                Push(pose.X - 1, pose.Y, pose.OriIndex);
+
+            if (playfield.PlacementTest(bmp, pose.X + 1, pose.Y) == PlacementTestResult::Succeeded)
+                Push(pose.X + 1, pose.Y, pose.OriIndex);
+
+            if (pBlock->OriCount > 1)
+            {
+                byte idx = (pose.OriIndex == pBlock->OriCount - 1 ? 0 : pose.OriIndex + 1);
+                int x = 0;
+                int y = 0;
+                if (playfield.RotationTest(pBlock, pose.OriIndex, idx, pose.X, pose.Y, x, y))
+                    Push(x, y, idx);
+            }
+
+            if (!canMoveDown)
+                return;
+
+            if (playfield.PlacementTest(bmp, pose.X, pose.Y - 1) == PlacementTestResult::Succeeded)
+                Push(pose.X, pose.Y - 1, pose.OriIndex);
+            else
+                placements.push_back(pose);
+        }
+
+        void Push(int x, int y, byte oriIndex)
+        {
+            int xx = x + XMargin;
+            int yy = y + YMargin - 1;
+            if (xx < 0 || xx >= m_Width || yy < 0 || yy >= m_Height)
+                return;
+
+            unsigned& stamp = m_Visited[(yy * m_Width + xx) * 4 + oriIndex];
+            if (stamp == m_Generation)
+                return;
+
+            stamp = m_Generation;
+            Placement pose = { x, y, oriIndex };
+            m_Queue.push_back(pose);
+        }
+    };
+
+    /// <summary>
+    /// The blocks of a game in the order they appear, generated exactly as Tetris does with a HeadlessHost of the
+    /// specified seed. The sequence does not depend on where the blocks are placed.
+    /// </summary>
+    class BlockSequence : public Tetris
+    {
+    public:
+        BlockSequence(uint64_t seed, int rows, int cols) : Tetris(&m_SequenceHost, rows, cols), m_SequenceHost(seed)
+        {
+            Start();
+            m_Blocks.push_back(m_pCurrentBlock);
+            m_Blocks.push_back(m_pNextBlock);
+        }
+
+        ~BlockSequence()
+        {
+            // The first two blocks are owned by the game
+            for (size_t i = 2; i < m_Blocks.size(); i++)
+                delete m_Blocks[i];
+        }
+
+        // Returns the specified block at its spawn pose. The returned block can be moved, it is reset by the next call.
+        Block* Get(int index)
+        {
+            while ((int)m_Blocks.size() <= index)
+                m_Blocks.push_back(CreateNewRandomBlock());
+
+            Block* pBlock = m_Blocks[index];
+            if (index >= (int)m_SpawnPoses.size())
+            {
+                Placement spawn = { pBlock->X, pBlock->Y, pBlock->OriIndex };
+                m_SpawnPoses.push_back(spawn);
+            }
+
+            pBlock->X = m_SpawnPoses[index].X;
+            pBlock->Y = m_SpawnPoses[index].Y;
+            pBlock->OriIndex = m_SpawnPoses[index].OriIndex;
+            return pBlock;
+        }
+
+    protected:
+        HeadlessHost m_SequenceHost;    // constructed after the Tetris base, which only stores its address
+        std::vector<Block*> m_Blocks;
+        std::vector<Placement> m_SpawnPoses;
+    };
+
+    /// <summary>
+    /// Counts the distinct placement sequences of the first blocks of a game (perft). The playfield type is the
+    /// collision implementation under test; every implementation has to give the same counts as Playfield.
+    /// One instance must be used by one thread only.
+    /// </summary>
+    template <class TPlayfield>
+    class PerftSearch
+    {
+    public:
+        PerftSearch(uint64_t seed, int rows, int cols, int maxDepth, const RotationSystem* pRotationSystem = NULL)
+            : m_Host(seed), m_Blocks(seed, rows, cols), m_Nodes(0)
+        {
+            for (int d = 0; d <= maxDepth; d++)
+            {
+                m_Boards.push_back(new TPlayfield(&m_Host, rows, cols));
+                m_Boards.back()->SetRotationSystem(pRotationSystem);
+                m_Placements.push_back(std::vector<Placement>());
+            }
+        }
+
+        ~PerftSearch()
+        {
+            for (size_t i = 0; i < m_Boards.size(); i++)
+                delete m_Boards[i];
+        }
+
+        // Number of placements generated since the construction, the work done by the search
+        uint64_t GetNodes() const { return m_Nodes; }
+
+        // Returns the placements of the first block on the empty playfield
+        const std::vector<Placement>& GetRootPlacements()
+        {
+            m_Boards[0]->Clear();
+            Generate(0, 0);
+            return m_Placements[0];
+        }
+
+        // Counts the placement sequences of the specified length starting from the empty playfield
+        uint64_t Count(int depth)
+        {
+            m_Boards[0]->Clear();
+            return Count(0, depth);
+        }
+
+        // Counts the placement sequences of the specified length which start with the specified placement of the
+        // first block (divide)
+        uint64_t CountFrom(const Placement& root, int depth)
+        {
+            if (depth <= 0)
+                return 1;
+
+            m_Boards[0]->Clear();
+            return Apply(0, root) ? Count(1, depth - 1) : 0;
+        }
+
+    protected:
+        HeadlessHost m_Host;
+        BlockSequence m_Blocks;
+        PlacementGenerator m_Generator;
+        std::vector<TPlayfield*> m_Boards;              // board before the block of the same index
+        std::vector<std::vector<Placement> > m_Placements;
+        uint64_t m_Nodes;
+
+        int Generate(int index, int board)
+        {
+            int cnt = m_Generator.Generate(*m_Boards[board], m_Blocks.Get(index), m_Placements[board]);
+            m_Nodes += cnt;
+            return cnt;
+        }
+
+        // Counts the sequences of the blocks from the specified index, on the board of the same index
+        uint64_t Count(int index, int depth)
+        {
+            if (depth <= 0)
+                return 1;
+
+            int cnt = Generate(index, index);
+            if (depth == 1)
+                return cnt;
+
+            uint64_t total = 0;
+            for (int i = 0; i < cnt; i++)
+            {
+                if (Apply(index, m_Placements[index][i]))
+                    total += Count(index + 1, depth - 1);
+            }
+
+            return total;
+        }
+
+        // Locks the block of the specified index at the specified pose and clears the completed rows like the game
+        // does, the result is the board of the next block. Returns false if the board would need a new playfield.
+        bool Apply(int index, const Placement& placement)
+        {
+            if (index + 1 >= (int)m_Boards.size())
+                return false;
+
+            Playfield& from = *m_Boards[index];
+            Playfield& to = *m_Boards[index + 1];
+
+            to.CopyFrom(from);
+
+            Block* pBlock = m_Blocks.Get(index);
+            pBlock->X = placement.X;
+            pBlock->Y = placement.Y;
+            pBlock->OriIndex = placement.OriIndex;
+            to.Occupy(pBlock);
+
+            int cnt = to.GetCompletedRows();
+            for (int i = 0; i < cnt; i++)
+                to.ClearRow(to.CompletedLines[i]);
+
+            return true;
+        }
+    };
+}
+
+#endif
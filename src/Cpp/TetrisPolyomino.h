@@ -0,0 +1,561 @@
+/*
+    Nanochord.Tetris
+
+    Table-driven polyomino pieces of up to 8x8 cells (e.g. pentominoes or custom shapes) with their rotations
+    computed when they are loaded, a bitboard playfield of up to 64 columns and a headless game played with them
+
+    MIT License - see Tetris.h for details.
+ */
+
+#ifndef _Nanochord_TetrisPolyomino_
+#define _Nanochord_TetrisPolyomino_
+
+#include "Tetris.h"
+#include "TetrisHeadless.h"
+#include <stdint.h>
+#include <vector>
+
+namespace Nanochord
+{
+    /// <summary>
+    /// One orientation of a piece. Mask has a bit for every cell of the 8x8 box: bit 8 * row + column, row 0 is the
+    /// top row. The box is tight, the first row and the first column are never empty.
+    /// </summary>
+    struct PieceOrientation
+    {
+        uint64_t Mask;
+        byte Rows[8];           // rows of the mask, bit c is the column c
+        byte Width;
+        byte Height;
+        signed char OffsetX;    // added to the position when the piece is rotated into this orientation
+        signed char OffsetY;
+
+        byte GetRow(int row) const { return Rows[row]; }
+        bool GetCell(int row, int col) const { return ((Mask >> (8 * row + col)) & 1) != 0; }
+    };
+
+    /// <summary>
+    /// A piece of a piece set with its distinct orientations in counter-clockwise order, like the rotation of the
+    /// game
+    /// </summary>
+    struct Polyomino
+    {
+        byte Color;
+        byte OriCount;
+        byte CellCount;
+        PieceOrientation Orientations[4];
+    };
+
+    /// <summary>
+    /// Operations on 8x8 shape masks (bit 8 * row + column)
+    /// </summary>
+    class PolyominoShape
+    {
+    public:
+        static const int MaxSize = 8;
+
+        // Parses a shape like ".#./###": rows separated by '/', '#' (or any character other than '.' and ' ') is a
+        // cell. Returns 0 if the shape does not fit into 8x8.
+        static uint64_t Parse(const char* art)
+        {
+            uint64_t mask = 0;
+            int row = 0;
+            int col = 0;
+
+            for (const char* p = art; *p != 0; p++)
+            {
+                if (*p == '/')
+                {
+                    row++;
+                    col = 0;
+                    continue;
+                }
+
+                if (row >= MaxSize || col >= MaxSize)
+                    return 0;
+
+                if (*p != '.' && *p != ' ')
+                    mask |= 1ULL << (8 * row + col);
+                col++;
+            }
+
+            return Normalize(mask);
+        }
+
+        // Moves the shape to the top left corner of the box
+        static uint64_t Normalize(uint64_t mask)
+        {
+            if (mask == 0)
+                return 0;
+
+            while ((mask & 0xFFULL) == 0)
+                mask >>= 8;
+
+            const uint64_t firstColumn = 0x0101010101010101ULL;
+            while ((mask & firstColumn) == 0)
+                mask >>= 1;
+
+            return mask;
+        }
+
+        static int GetWidth(uint64_t mask)
+        {
+            byte cols = 0;
+            for (int r = 0; r < MaxSize; r++)
+                cols |= (byte)(mask >> (8 * r));
+
+            int width = 0;
+            while (cols != 0)
+            {
+                width++;
+                cols >>= 1;
+            }
+
+            return width;
+        }
+
+        static int GetHeight(uint64_t mask)
+        {
+            int height = 0;
+            while (mask != 0)
+            {
+                height++;
+                mask >>= 8;
+            }
+
+            return height;
+        }
+
+        static int GetCellCount(uint64_t mask)
+        {
+            int cnt = 0;
+            for (; mask != 0; mask &= mask - 1)
+                cnt++;
+
+            return cnt;
+        }
+
+        // Rotates the normalized shape counter-clockwise: the top right cell becomes the top left one
+        static uint64_t RotateLeft(uint64_t mask)
+        {
+            int width = GetWidth(mask);
+            uint64_t rotated = 0;
+
+            for (int r = 0; r < MaxSize; r++)
+            {
+                for (int c = 0; c < width; c++)
+                {
+                    if (((mask >> (8 * r + c)) & 1) != 0)
+                        rotated |= 1ULL << (8 * (width - 1 - c) + r);
+                }
+            }
+
+            return rotated;
+        }
+
+        // Mirrors the normalized shape horizontally
+        static uint64_t Mirror(uint64_t mask)
+        {
+            int width = GetWidth(mask);
+            uint64_t mirrored = 0;
+
+            for (int r = 0; r < MaxSize; r++)
+            {
+                for (int c = 0; c < width; c++)
+                {
+                    if (((mask >> (8 * r + c)) & 1) != 0)
+                        mirrored |= 1ULL << (8 * r + width - 1 - c);
+                }
+            }
+
+            return mirrored;
+        }
+    };
+
+    /// <summary>
+    /// The pieces of a game. The orientations of every piece are computed when it is added: the shape is rotated
+    /// until it repeats, so symmetric pieces have 1 or 2 orientations. The rotation keeps the center of the box.
+    /// </summary>
+    class PieceSet
+    {
+    public:
+        int GetCount() const { return (int)m_Pieces.size(); }
+        const Polyomino& Get(int index) const { return m_Pieces[index]; }
+
+        // Adds a piece in its spawn orientation. If mirrored is true, its mirror image is also added as another
+        // piece unless it is one of the rotations (one-sided polyominoes). Returns false if the shape is empty or
+        // larger than 8x8.
+        bool Add(uint64_t mask, byte color, bool mirrored = false)
+        {
+            mask = PolyominoShape::Normalize(mask);
+            if (mask == 0)
+                return false;
+
+            Polyomino piece;
+            piece.Color = color;
+            piece.CellCount = (byte)PolyominoShape::GetCellCount(mask);
+            piece.OriCount = 0;
+
+            uint64_t ori = mask;
+            do
+            {
+                PieceOrientation& o = piece.Orientations[piece.OriCount++];
+                o.Mask = ori;
+                o.Width = (byte)PolyominoShape::GetWidth(ori);
+                o.Height = (byte)PolyominoShape::GetHeight(ori);
+                for (int r = 0; r < PolyominoShape::MaxSize; r++)
+                    o.Rows[r] = (byte)(ori >> (8 * r));
+
+                ori = PolyominoShape::RotateLeft(ori);
+            } while (ori != mask && piece.OriCount < 4);
+
+            // The offsets of rotating into every orientation from the previous one keep the center of the box
+            // (rounded the same way in both directions, so rotating back and forth does not move the piece)
+            for (int i = 0; i < piece.OriCount; i++)
+            {
+                const PieceOrientation& from = piece.Orientations[i == 0 ? piece.OriCount - 1 : i - 1];
+                PieceOrientation& to = piece.Orientations[i];
+                to.OffsetX = (signed char)((from.Width - to.Width) / 2);
+                to.OffsetY = (signed char)(-((from.Height - to.Height) / 2));
+            }
+
+            m_Pieces.push_back(piece);
+
+            if (mirrored)
+            {
+                uint64_t image = PolyominoShape::Mirror(mask);
+                bool isRotation = false;
+                for (int i = 0; i < piece.OriCount; i++)
+                    if (piece.Orientations[i].Mask == image)
+                        isRotation = true;
+
+                if (!isRotation)
+                    Add(image, color, false);
+            }
+
+            return true;
+        }
+
+        bool Add(const char* art, byte color, bool mirrored = false)
+        {
+            return Add(PolyominoShape::Parse(art), color, mirrored);
+        }
+
+        // The seven tetrominoes in the spawn orientation and with the colors of the Block classes
+        static PieceSet Tetrominoes()
+        {
+            PieceSet set;
+            set.Add("##/##", 1);
+            set.Add("####", 2);
+            set.Add(".##/##.", 3);
+            set.Add("##./.##", 4);
+            set.Add("###/#..", 5);
+            set.Add("###/..#", 6);
+            set.Add("###/.#.", 7);
+            return set;
+        }
+
+        // The 12 free pentominoes (F, I, L, N, P, T, U, V, W, X, Y, Z), or the 18 one-sided ones
+        static PieceSet Pentominoes(bool oneSided = false)
+        {
+            static const char* const shapes[] =
+            {
+                ".##/##./.#.", "#####", "####/#...", "##../.###", "##/##/#.", "###/.#./.#.",
+                "#.#/###", "#../#../###", "#../##./.##", ".#./###/.#.", ".#../####", "##./.#./.##"
+            };
+
+            PieceSet set;
+            for (int i = 0; i < 12; i++)
+                set.Add(shapes[i], (byte)(1 + i % 7), oneSided);
+            return set;
+        }
+
+    protected:
+        std::vector<Polyomino> m_Pieces;
+    };
+
+    /// <summary>
+    /// Playfield of up to 64 columns for polyominoes: an occupancy mask per row (bit x is the column x) for the
+    /// collision tests and the complete rows, and a color per cell. A piece at (x, y) covers the columns from x and
+    /// the rows from y downwards, a collision test is one shift and AND per row of the piece.
+    /// </summary>
+    class PolyominoBoard
+    {
+    public:
+        static const int MaxColumns = 64;
+
+        PolyominoBoard(int rows, int cols)
+        {
+            m_Rows = rows < 1 ? 1 : rows;
+            m_Columns = cols < 1 ? 1 : cols > MaxColumns ? MaxColumns : cols;
+            m_Full = m_Columns >= 64 ? ~0ULL : (1ULL << m_Columns) - 1;
+            m_Height = 0;
+            m_Masks.assign(m_Rows, 0);
+            m_Colors.assign((size_t)m_Rows * m_Columns, 0);
+        }
+
+        int GetRows() const { return m_Rows; }
+        int GetColumns() const { return m_Columns; }
+        int GetHeight() const { return m_Height; }
+        uint64_t GetRowMask(int y) const { return m_Masks[y]; }
+        byte GetCell(int x, int y) const { return m_Colors[(size_t)y * m_Columns + x]; }
+
+        void Clear()
+        {
+            for (int y = 0; y < m_Height; y++)
+            {
+                m_Masks[y] = 0;
+                for (int x = 0; x < m_Columns; x++)
+                    m_Colors[(size_t)y * m_Columns + x] = 0;
+            }
+
+            m_Height = 0;
+        }
+
+        // Tells whether the piece can be at the specified position: inside the walls, above the floor and without
+        // overlapping the stack. The rows above the top of the board are free.
+        bool Fits(const PieceOrientation& ori, int x, int y) const
+        {
+            if (x < 0 || x + ori.Width > m_Columns || y - ori.Height + 1 < 0)
+                return false;
+
+            int r = y >= m_Height ? y - m_Height + 1 : 0;
+            for (; r < ori.Height; r++)
+            {
+                if ((m_Masks[y - r] & ((uint64_t)ori.Rows[r] << x)) != 0)
+                    return false;
+            }
+
+            return true;
+        }
+
+        // Stores the piece at the specified position, where it fits. Returns false if a cell of it is above the
+        // top of the board (the game is over).
+        bool Place(const PieceOrientation& ori, int x, int y, byte color)
+        {
+            bool inside = true;
+
+            for (int r = 0; r < ori.Height; r++)
+            {
+                int yy = y - r;
+                if (yy >= m_Rows)
+                {
+                    inside = false;
+                    continue;
+                }
+
+                m_Masks[yy] |= (uint64_t)ori.Rows[r] << x;
+                for (int c = 0; c < ori.Width; c++)
+                {
+                    if ((ori.Rows[r] & (1 << c)) != 0)
+                        m_Colors[(size_t)yy * m_Columns + x + c] = color;
+                }
+
+                if (yy >= m_Height)
+                    m_Height = yy + 1;
+            }
+
+            return inside;
+        }
+
+        // Removes the complete rows, the rows above them move down. Returns the number of removed rows.
+        int ClearFullRows()
+        {
+            int to = 0;
+
+            for (int y = 0; y < m_Height; y++)
+            {
+                if (m_Masks[y] == m_Full)
+                    continue;
+
+                if (to != y)
+                {
+                    m_Masks[to] = m_Masks[y];
+                    for (int x = 0; x < m_Columns; x++)
+                        m_Colors[(size_t)to * m_Columns + x] = m_Colors[(size_t)y * m_Columns + x];
+                }
+                to++;
+            }
+
+            int cleared = m_Height - to;
+            for (int y = to; y < m_Height; y++)
+            {
+                m_Masks[y] = 0;
+                for (int x = 0; x < m_Columns; x++)
+                    m_Colors[(size_t)y * m_Columns + x] = 0;
+            }
+
+            m_Height = to;
+            while (m_Height > 0 && m_Masks[m_Height - 1] == 0)
+                m_Height--;
+
+            return cleared;
+        }
+
+    protected:
+        int m_Rows;
+        int m_Columns;
+        int m_Height;               // rows at and above this one are empty
+        uint64_t m_Full;
+        std::vector<uint64_t> m_Masks;
+        std::vector<byte> m_Colors;
+    };
+
+    /// <summary>
+    /// Headless game with the pieces of a PieceSet: the same moves as Tetris (left, right, counter-clockwise
+    /// rotation, gravity step and drop), pieces drawn uniformly from a HeadlessHost of the specified seed. A rotated
+    /// piece which does not fit is kicked by up to two columns.
+    /// </summary>
+    class PolyominoGame
+    {
+    public:
+        PolyominoGame(const PieceSet& pieces, int rows, int cols, uint64_t seed = 1)
+            : m_Pieces(pieces), m_Board(rows, cols), m_Host(seed)
+        {
+            m_Piece = 0;
+            m_OriIndex = 0;
+            m_X = 0;
+            m_Y = 0;
+            m_LinesCompleted = 0;
+            m_PieceCount = 0;
+            m_GameOver = true;
+        }
+
+        void Start()
+        {
+            m_Board.Clear();
+            m_LinesCompleted = 0;
+            m_PieceCount = 0;
+            m_GameOver = false;
+            Spawn();
+        }
+
+        const PolyominoBoard& GetBoard() const { return m_Board; }
+        const PieceSet& GetPieces() const { return m_Pieces; }
+        bool GetGameOver() const { return m_GameOver; }
+        int GetLinesCompleted() const { return m_LinesCompleted; }
+        int GetPieceCount() const { return m_PieceCount; }
+
+        // The current piece and its position
+        int GetPiece() const { return m_Piece; }
+        int GetOriIndex() const { return m_OriIndex; }
+        int GetX() const { return m_X; }
+        int GetY() const { return m_Y; }
+
+        const PieceOrientation& GetOrientation() const
+        {
+            return m_Pieces.Get(m_Piece).Orientations[m_OriIndex];
+        }
+
+        bool MoveLeft() { return TryMove(m_X - 1, m_Y, m_OriIndex); }
+        bool MoveRight() { return TryMove(m_X + 1, m_Y, m_OriIndex); }
+
+        bool Rotate()
+        {
+            if (m_GameOver)
+                return false;
+
+            const Polyomino& piece = m_Pieces.Get(m_Piece);
+            if (piece.OriCount < 2)
+                return false;
+
+            static const int kicks[] = { 0, -1, 1, -2, 2 };
+            int idx = m_OriIndex == piece.OriCount - 1 ? 0 : m_OriIndex + 1;
+            const PieceOrientation& ori = piece.Orientations[idx];
+
+            for (int i = 0; i < 5; i++)
+            {
+                if (TryMove(m_X + ori.OffsetX + kicks[i], m_Y + ori.OffsetY, idx))
+                    return true;
+            }
+
+            return false;
+        }
+
+        // Moves the piece down by one row, or locks it if it cannot move. Returns true if the piece was locked.
+        bool Step()
+        {
+            if (m_GameOver)
+                return false;
+
+            if (TryMove(m_X, m_Y - 1, m_OriIndex))
+                return false;
+
+            Lock();
+            return true;
+        }
+
+        // Moves the piece down as far as it can go and locks it. Returns the number of rows it fell.
+        int Drop()
+        {
+            if (m_GameOver)
+                return 0;
+
+            int rows = 0;
+            while (TryMove(m_X, m_Y - 1, m_OriIndex))
+                rows++;
+
+            Lock();
+            return rows;
+        }
+
+    protected:
+        PieceSet m_Pieces;
+        PolyominoBoard m_Board;
+        HeadlessHost m_Host;
+        int m_Piece;
+        int m_OriIndex;
+        int m_X;
+        int m_Y;
+        int m_LinesCompleted;
+        int m_PieceCount;
+        bool m_GameOver;
+
+        bool TryMove(int x, int y, int oriIndex)
+        {
+            if (m_GameOver || !m_Board.Fits(m_Pieces.Get(m_Piece).Orientations[oriIndex], x, y))
+                return false;
+
+            m_X = x;
+            m_Y = y;
+            m_OriIndex = oriIndex;
+            return true;
+        }
+
+        void Lock()
+        {
+            const Polyomino& piece = m_Pieces.Get(m_Piece);
+            if (!m_Board.Place(piece.Orientations[m_OriIndex], m_X, m_Y, piece.Color))
+            {
+                m_GameOver = true;
+                return;
+            }
+
+            m_LinesCompleted += m_Board.ClearFullRows();
+            m_PieceCount++;
+            Spawn();
+        }
+
+        // The new piece appears at the top middle; the game is over if it does not fit there
+        void Spawn()
+        {
+            if (m_Pieces.GetCount() == 0)
+            {
+                m_GameOver = true;
+                return;
+            }
+
+            m_Piece = m_Host.Random(m_Pieces.GetCount());
+            m_OriIndex = 0;
+
+            const PieceOrientation& ori = GetOrientation();
+            m_X = (m_Board.GetColumns() - ori.Width) / 2;
+            m_Y = m_Board.GetRows() - 1;
+
+            if (!m_Board.Fits(ori, m_X, m_Y))
+                m_GameOver = true;
+        }
+    };
+}
+
+#endif
@@ -0,0 +1,570 @@
+/*
+    Nanochord.Tetris
+
+    Replays of headless games with periodic full-state checkpoints for seeking in constant time
+
+    MIT License - see Tetris.h for details.
+ */
+
+#ifndef _Nanochord_TetrisReplay_
+#define _Nanochord_TetrisReplay_
+
+#include "Tetris.h"
+#include "TetrisHeadless.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+namespace Nanochord
+{
+    /// <summary>
+    /// The player actions of a tick, combined into the input byte of the tick. They are applied in this order; the
+    /// drop and the gravity step (Run) come last.
+    /// </summary>
+    enum ReplayInput
+    {
+        ReplayPause = 0x01,
+        ReplayLeft = 0x02,
+        ReplayRight = 0x04,
+        ReplayRotate = 0x08,
+        ReplayDrop = 0x10,
+        ReplayStep = 0x20
+    };
+
+    /// <summary>
+    /// A falling block in a checkpoint, color 0 means no block
+    /// </summary>
+    struct ReplayBlock
+    {
+        byte Color = 0;
+        int X = 0;
+        int Y = 0;
+        byte OriIndex = 0;
+    };
+
+    /// <summary>
+    /// The full state of a replayed game before the inputs of a tick
+    /// </summary>
+    struct ReplayCheckpoint
+    {
+        unsigned long Tick = 0;
+        uint64_t RandomState = 0;       // of the random generator of the game
+        uint64_t RandomHash = 0;        // the random part of Tetris::GetStateHash, 0 without TETRIS_STATE_HASH
+        int Height = 0;
+        std::vector<byte> Cells;        // 3 bits per cell of the rows below Height, row-major from the bottom row
+        ReplayBlock CurrentBlock;
+        ReplayBlock NextBlock;
+        byte ActualLevel = 1;
+        int ActualPoints = 0;
+        int LinesCompleted = 0;
+        bool IsPaused = false;
+        bool GameOver = false;
+    };
+
+    /// <summary>
+    /// Headless game which draws its blocks from its own random generator, so it is completely determined by its
+    /// seed and its inputs. Its state can be captured into a checkpoint and restored from it.
+    /// </summary>
+    class ReplayTetris : public Tetris
+    {
+    public:
+        ReplayTetris(int rows, int cols) : Tetris(&m_ReplayHost, rows, cols)
+        {
+        }
+
+        using Tetris::Start;
+
+        // Starts a new game with the specified seed
+        int Start(uint64_t seed)
+        {
+            m_ReplayHost.Seed(seed);
+            return Tetris::Start();
+        }
+
+        // Applies the inputs of a tick (a combination of ReplayInput flags)
+        void Apply(byte input)
+        {
+            if ((input & ReplayPause) != 0)
+                Pause();
+            if ((input & ReplayLeft) != 0)
+                MoveLeft();
+            if ((input & ReplayRight) != 0)
+                MoveRight();
+            if ((input & ReplayRotate) != 0)
+                Rotate();
+            if ((input & ReplayDrop) != 0)
+                Drop();
+            if ((input & ReplayStep) != 0)
+                Run();
+        }
+
+        void Capture(ReplayCheckpoint& checkpoint, unsigned long tick) const
+        {
+            int cols = m_Playfield.GetColumns();
+            int height = m_Playfield.GetHeight();
+
+            checkpoint.Tick = tick;
+            checkpoint.RandomState = m_ReplayHost.GetRandomState();
+#ifdef TETRIS_STATE_HASH
+            checkpoint.RandomHash = m_RandomHash;
+#else
+            checkpoint.RandomHash = 0;
+#endif
+
+            // Colors are 1-7, three bits per cell
+            checkpoint.Height = height;
+            checkpoint.Cells.assign(((size_t)height * cols * 3 + 7) / 8, 0);
+            size_t bit = 0;
+            for (int y = 0; y < height; y++)
+            {
+                for (int x = 0; x < cols; x++, bit += 3)
+                {
+                    unsigned value = m_Playfield.GetCell(x, y) & 7;
+                    checkpoint.Cells[bit >> 3] |= (byte)(value << (bit & 7));
+                    if ((bit & 7) > 5)
+                        checkpoint.Cells[(bit >> 3) + 1] |= (byte)(value >> (8 - (bit & 7)));
+                }
+            }
+
+            CaptureBlock(checkpoint.CurrentBlock, m_pCurrentBlock);
+            CaptureBlock(checkpoint.NextBlock, m_pNextBlock);
+            checkpoint.ActualLevel = m_ActualLevel;
+            checkpoint.ActualPoints = m_ActualPoints;
+            checkpoint.LinesCompleted = m_LinesCompleted;
+            checkpoint.IsPaused = m_IsPaused;
+            checkpoint.GameOver = m_GameOver;
+        }
+
+        // Restores the state of a checkpoint captured from a game of the same size. The cells are read with the
+        // column count of the replay, which holds the checkpoint.
+        void Restore(const ReplayCheckpoint& checkpoint, int cols)
+        {
+            m_Playfield.Clear();
+            size_t bit = 0;
+            for (int y = 0; y < checkpoint.Height; y++)
+            {
+                for (int x = 0; x < cols; x++, bit += 3)
+                {
+                    unsigned value = checkpoint.Cells[bit >> 3] >> (bit & 7);
+                    if ((bit & 7) > 5)
+                        value |= checkpoint.Cells[(bit >> 3) + 1] << (8 - (bit & 7));
+                    if ((value & 7) != 0 && x < m_Playfield.GetColumns() && y < m_Playfield.GetRows())
+                        m_Playfield.SetCell(x, y, (byte)(value & 7));
+                }
+            }
+            m_Playfield.ResetDamage();
+
+            RestoreBlock(m_pCurrentBlock, checkpoint.CurrentBlock);
+            RestoreBlock(m_pNextBlock, checkpoint.NextBlock);
+            m_ActualLevel = checkpoint.ActualLevel;
+            m_ActualPoints = checkpoint.ActualPoints;
+            m_LinesCompleted = checkpoint.LinesCompleted;
+            m_IsPaused = checkpoint.IsPaused;
+            m_GameOver = checkpoint.GameOver;
+            m_ReplayHost.SetRandomState(checkpoint.RandomState);
+
+#ifdef TETRIS_STATE_HASH
+            RecalculateStateHash();
+            m_RandomHash = checkpoint.RandomHash;
+#endif
+        }
+
+        uint64_t GetRandomState() const { return m_ReplayHost.GetRandomState(); }
+
+        // Tells whether a block of a checkpoint can be restored into a playfield with the specified number of
+        // columns: its color and orientation exist, and its bitmap is inside the columns and not below row 0.
+        // No block (color 0) is valid.
+        static bool IsValidBlock(const ReplayBlock& state, int cols)
+        {
+            if (state.Color == 0)
+                return true;
+
+            Block* pBlock = CreateBlock(state.Color);
+            bool valid = pBlock != NULL && state.OriIndex < pBlock->OriCount;
+
+            for (int i = 0; i < 4 && valid; i++)
+            {
+                byte bits = pBlock->OriBitmaps[state.OriIndex][i];
+                for (int k = 0; k < 4 && valid; k++)
+                {
+                    long long x = (long long)state.X - 2 + k;
+                    long long y = (long long)state.Y + 1 - i;
+                    if ((bits & (0x8 >> k)) != 0 && (x < 0 || x >= cols || y < 0))
+                        valid = false;
+                }
+            }
+
+            delete pBlock;
+            return valid;
+        }
+
+    protected:
+        HeadlessHost m_ReplayHost;      // constructed after the Tetris base, which only stores its address
+
+        static void CaptureBlock(ReplayBlock& state, const Block* pBlock)
+        {
+            state.Color = pBlock != NULL ? pBlock->Color : 0;
+            state.X = pBlock != NULL ? pBlock->X : 0;
+            state.Y = pBlock != NULL ? pBlock->Y : 0;
+            state.OriIndex = pBlock != NULL ? pBlock->OriIndex : 0;
+        }
+
+        void RestoreBlock(Block*& pBlock, const ReplayBlock& state)
+        {
+            if (pBlock != NULL && pBlock->Color != state.Color)
+            {
+                delete pBlock;
+                pBlock = NULL;
+            }
+
+            if (state.Color == 0)
+                return;
+
+            if (pBlock == NULL)
+                pBlock = CreateBlock(state.Color);
+
+            pBlock->X = state.X;
+            pBlock->Y = state.Y;
+            pBlock->OriIndex = state.OriIndex;
+        }
+    };
+
+    /// <summary>
+    /// A recorded game: the size, the seed, one input byte per tick and a checkpoint every checkpoint interval
+    /// ticks (the first one at tick 0). Saved as a little-endian binary file.
+    /// </summary>
+    class Replay
+    {
+        friend class ReplayRecorder;
+
+    public:
+        static const uint32_t Magic = 0x5052544E;     // "NTRP"
+        static const int Version = 1;
+
+        Replay()
+        {
+            m_Rows = 0;
+            m_Columns = 0;
+            m_Seed = 0;
+            m_CheckpointInterval = 0;
+        }
+
+        int GetRows() const { return m_Rows; }
+        int GetColumns() const { return m_Columns; }
+        uint64_t GetSeed() const { return m_Seed; }
+        int GetCheckpointInterval() const { return m_CheckpointInterval; }
+        unsigned long GetTickCount() const { return (unsigned long)m_Inputs.size(); }
+        const std::vector<byte>& GetInputs() const { return m_Inputs; }
+        const std::vector<ReplayCheckpoint>& GetCheckpoints() const { return m_Checkpoints; }
+
+        // Returns the checkpoint to start from to reach the specified tick: the last one at or before it. A recorded
+        // or loaded replay has at least the one of tick 0.
+        const ReplayCheckpoint& GetCheckpoint(unsigned long tick) const
+        {
+            size_t index = m_CheckpointInterval > 0 ? tick / m_CheckpointInterval : 0;
+            if (index >= m_Checkpoints.size())
+                index = m_Checkpoints.size() - 1;
+
+            return m_Checkpoints[index];
+        }
+
+        void Save(std::vector<byte>& data) const
+        {
+            data.clear();
+            WriteInt(data, Magic, 4);
+            WriteInt(data, Version, 1);
+            WriteInt(data, (uint32_t)m_Rows, 4);
+            WriteInt(data, (uint32_t)m_Columns, 4);
+            WriteInt(data, m_Seed, 8);
+            WriteInt(data, (uint32_t)m_CheckpointInterval, 4);
+
+            WriteInt(data, (uint32_t)m_Inputs.size(), 4);
+            data.insert(data.end(), m_Inputs.begin(), m_Inputs.end());
+
+            WriteInt(data, (uint32_t)m_Checkpoints.size(), 4);
+            for (size_t i = 0; i < m_Checkpoints.size(); i++)
+            {
+                const ReplayCheckpoint& cp = m_Checkpoints[i];
+                WriteInt(data, (uint32_t)cp.Tick, 4);
+                WriteInt(data, cp.RandomState, 8);
+                WriteInt(data, cp.RandomHash, 8);
+                WriteBlock(data, cp.CurrentBlock);
+                WriteBlock(data, cp.NextBlock);
+                WriteInt(data, cp.ActualLevel, 1);
+                WriteInt(data, (uint32_t)cp.ActualPoints, 4);
+                WriteInt(data, (uint32_t)cp.LinesCompleted, 4);
+                WriteInt(data, (cp.IsPaused ? 1 : 0) | (cp.GameOver ? 2 : 0), 1);
+                WriteInt(data, (uint32_t)cp.Height, 4);
+                data.insert(data.end(), cp.Cells.begin(), cp.Cells.end());
+            }
+        }
+
+        // Returns false if the data is not a valid replay
+        bool Load(const byte* data, size_t size)
+        {
+            Reader reader = { data, data + size };
+            uint64_t magic = 0;
+            uint64_t version = 0;
+            uint64_t rows = 0;
+            uint64_t cols = 0;
+            uint64_t interval = 0;
+            uint64_t ticks = 0;
+            uint64_t count = 0;
+
+            if (!reader.Read(magic, 4) || magic != Magic || !reader.Read(version, 1) || version != Version ||
+                !reader.Read(rows, 4) || !reader.Read(cols, 4) || !reader.Read(m_Seed, 8) || !reader.Read(interval, 4) ||
+                !reader.Read(ticks, 4) || (uint64_t)(reader.End - reader.Data) < ticks)
+            {
+                return false;
+            }
+
+            // The size has to be one the playfield accepts as is, at least 10x10
+            if (rows < 10 || cols < 10 || rows * cols > 0x7FFFFFFF)
+            {
+                return false;
+            }
+
+            m_Rows = (int)rows;
+            m_Columns = (int)cols;
+            m_CheckpointInterval = (int)interval;
+            m_Inputs.assign(reader.Data, reader.Data + ticks);
+            reader.Data += ticks;
+
+            if (!reader.Read(count, 4) || count == 0 || count > ticks + 1)
+                return false;
+
+            m_Checkpoints.assign((size_t)count, ReplayCheckpoint());
+            for (size_t i = 0; i < m_Checkpoints.size(); i++)
+            {
+                ReplayCheckpoint& cp = m_Checkpoints[i];
+                uint64_t tick = 0;
+                uint64_t level = 0;
+                uint64_t points = 0;
+                uint64_t lines = 0;
+                uint64_t flags = 0;
+                uint64_t height = 0;
+
+                if (!reader.Read(tick, 4) || !reader.Read(cp.RandomState, 8) || !reader.Read(cp.RandomHash, 8) ||
+                    !ReadBlock(reader, cp.CurrentBlock) || !ReadBlock(reader, cp.NextBlock) || !reader.Read(level, 1) ||
+                    !reader.Read(points, 4) || !reader.Read(lines, 4) || !reader.Read(flags, 1) || !reader.Read(height, 4) ||
+                    height > rows || tick != i * interval || tick > ticks ||
+                    !ReplayTetris::IsValidBlock(cp.CurrentBlock, (int)cols) || !ReplayTetris::IsValidBlock(cp.NextBlock, (int)cols))
+                {
+                    return false;
+                }
+
+                size_t cellBytes = (size_t)((height * cols * 3 + 7) / 8);
+                if ((size_t)(reader.End - reader.Data) < cellBytes)
+                    return false;
+
+                cp.Tick = (unsigned long)tick;
+                cp.ActualLevel = (byte)level;
+                cp.ActualPoints = (int)(uint32_t)points;
+                cp.LinesCompleted = (int)(uint32_t)lines;
+                cp.IsPaused = (flags & 1) != 0;
+                cp.GameOver = (flags & 2) != 0;
+                cp.Height = (int)height;
+                cp.Cells.assign(reader.Data, reader.Data + cellBytes);
+                reader.Data += cellBytes;
+            }
+
+            return true;
+        }
+
+        bool SaveFile(const char* path) const
+        {
+            std::vector<byte> data;
+            Save(data);
+
+            FILE* pFile = fopen(path, "wb");
+            if (pFile == NULL)
+                return false;
+
+            bool res = fwrite(data.data(), 1, data.size(), pFile) == data.size();
+            return fclose(pFile) == 0 && res;
+        }
+
+        bool LoadFile(const char* path)
+        {
+            FILE* pFile = fopen(path, "rb");
+            if (pFile == NULL)
+                return false;
+
+            std::vector<byte> data;
+            byte buffer[4096];
+            size_t cnt = 0;
+            while ((cnt = fread(buffer, 1, sizeof(buffer), pFile)) > 0)
+                data.insert(data.end(), buffer, buffer + cnt);
+
+            bool res = ferror(pFile) == 0;
+            fclose(pFile);
+            return res && Load(data.data(), data.size());
+        }
+
+    protected:
+        int m_Rows;
+        int m_Columns;
+        uint64_t m_Seed;
+        int m_CheckpointInterval;
+        std::vector<byte> m_Inputs;
+        std::vector<ReplayCheckpoint> m_Checkpoints;
+
+        struct Reader
+        {
+            const byte* Data;
+            const byte* End;
+
+            bool Read(uint64_t& value, int bytes)
+            {
+                if (End - Data < bytes)
+                    return false;
+
+                value = 0;
+                for (int i = 0; i < bytes; i++)
+                    value |= (uint64_t)*Data++ << (8 * i);
+                return true;
+            }
+        };
+
+        static void WriteInt(std::vector<byte>& data, uint64_t value, int bytes)
+        {
+            for (int i = 0; i < bytes; i++)
+                data.push_back((byte)(value >> (8 * i)));
+        }
+
+        static void WriteBlock(std::vector<byte>& data, const ReplayBlock& block)
+        {
+            WriteInt(data, block.Color, 1);
+            WriteInt(data, (uint32_t)block.X, 4);
+            WriteInt(data, (uint32_t)block.Y, 4);
+            WriteInt(data, block.OriIndex, 1);
+        }
+
+        static bool ReadBlock(Reader& reader, ReplayBlock& block)
+        {
+            uint64_t color = 0;
+            uint64_t x = 0;
+            uint64_t y = 0;
+            uint64_t oriIndex = 0;
+            if (!reader.Read(color, 1) || !reader.Read(x, 4) || !reader.Read(y, 4) || !reader.Read(oriIndex, 1) ||
+                color > 7 || oriIndex > 3)
+            {
+                return false;
+            }
+
+            block.Color = (byte)color;
+            block.X = (int)(int32_t)(uint32_t)x;
+            block.Y = (int)(int32_t)(uint32_t)y;
+            block.OriIndex = (byte)oriIndex;
+            return true;
+        }
+    };
+
+    /// <summary>
+    /// Plays a headless game and records it into a Replay
+    /// </summary>
+    class ReplayRecorder
+    {
+    public:
+        ReplayRecorder(int rows, int cols, int checkpointInterval = 600) : m_Game(rows, cols)
+        {
+            m_CheckpointInterval = checkpointInterval;
+        }
+
+        const ReplayTetris& GetGame() const { return m_Game; }
+        const Replay& GetReplay() const { return m_Replay; }
+
+        // Starts a new game and a new replay
+        void Start(uint64_t seed)
+        {
+            m_Game.Start(seed);
+
+            m_Replay.m_Rows = m_Game.GetPlayfield().GetRows();
+            m_Replay.m_Columns = m_Game.GetPlayfield().GetColumns();
+            m_Replay.m_Seed = seed;
+            m_Replay.m_CheckpointInterval = m_CheckpointInterval;
+            m_Replay.m_Inputs.clear();
+            m_Replay.m_Checkpoints.assign(1, ReplayCheckpoint());
+            m_Game.Capture(m_Replay.m_Checkpoints[0], 0);
+        }
+
+        // Applies and records the inputs of the next tick
+        void Apply(byte input)
+        {
+            m_Game.Apply(input);
+            m_Replay.m_Inputs.push_back(input);
+
+            unsigned long tick = m_Replay.GetTickCount();
+            if (m_CheckpointInterval > 0 && tick % m_CheckpointInterval == 0)
+            {
+                m_Replay.m_Checkpoints.push_back(ReplayCheckpoint());
+                m_Game.Capture(m_Replay.m_Checkpoints.back(), tick);
+            }
+        }
+
+    protected:
+        ReplayTetris m_Game;
+        Replay m_Replay;
+        int m_CheckpointInterval;
+    };
+
+    /// <summary>
+    /// Plays a Replay back. Seek restores the last checkpoint before the target tick and applies the inputs from
+    /// there, so it replays at most one checkpoint interval of ticks however long the game is.
+    /// </summary>
+    class ReplayPlayer
+    {
+    public:
+        ReplayPlayer(const Replay& replay) : m_Replay(replay), m_Game(replay.GetRows(), replay.GetColumns())
+        {
+            m_Tick = 0;
+            if (!m_Replay.GetCheckpoints().empty())
+                m_Game.Restore(m_Replay.GetCheckpoint(0), m_Replay.GetColumns());
+        }
+
+        // The game in the state before the inputs of the current tick
+        const ReplayTetris& GetGame() const { return m_Game; }
+        unsigned long GetTick() const { return m_Tick; }
+        bool IsAtEnd() const { return m_Tick >= m_Replay.GetTickCount(); }
+
+        // Applies the inputs of the current tick. Returns false at the end of the replay.
+        bool Step()
+        {
+            if (IsAtEnd())
+                return false;
+
+            m_Game.Apply(m_Replay.GetInputs()[m_Tick]);
+            m_Tick++;
+            return true;
+        }
+
+        // Moves to the state before the inputs of the specified tick (the end of the replay at most)
+        void Seek(unsigned long tick)
+        {
+            if (m_Replay.GetCheckpoints().empty())
+                return;
+            if (tick > m_Replay.GetTickCount())
+                tick = m_Replay.GetTickCount();
+
+            // Playing forward is shorter than restoring when the target is between the current tick and the next
+            // checkpoint
+            const ReplayCheckpoint& checkpoint = m_Replay.GetCheckpoint(tick);
+            if (tick < m_Tick || checkpoint.Tick > m_Tick)
+            {
+                m_Game.Restore(checkpoint, m_Replay.GetColumns());
+                m_Tick = checkpoint.Tick;
+            }
+
+            while (m_Tick < tick)
+                Step();
+        }
+
+    protected:
+        const Replay& m_Replay;
+        ReplayTetris m_Game;
+        unsigned long m_Tick;
+    };
+}
+
+#endif
@@ -0,0 +1,268 @@
+/*
+    Nanochord.Tetris
+
+    Monte Carlo evaluation of placements with random or cheap heuristic rollouts on copies of a game
+
+    MIT License - see Tetris.h for details.
+ */
+
+#ifndef _Nanochord_TetrisRollout_
+#define _Nanochord_TetrisRollout_
+
+#include "Tetris.h"
+#include "TetrisHeadless.h"
+#include "TetrisPerft.h"
+#include <stdint.h>
+#include <functional>
+#include <thread>
+#include <vector>
+
+namespace Nanochord
+{
+    enum RolloutPolicy
+    {
+        RolloutRandom,              // every placement is chosen with the same probability
+        RolloutLowest               // the lowest placement, ties are broken randomly
+    };
+
+    /// <summary>
+    /// Parameters of the Monte Carlo evaluation
+    /// </summary>
+    struct RolloutOptions
+    {
+        int Rollouts = 64;          // rollouts per candidate placement
+        int Horizon = 10;           // placements after the candidate in one rollout
+        RolloutPolicy Policy = RolloutRandom;
+        uint64_t Seed = 1;          // the rollouts are reproducible for a seed, independently of the thread count
+        int Threads = 0;            // 0 means the number of hardware threads
+    };
+
+    /// <summary>
+    /// Averaged outcome of the rollouts of one candidate placement
+    /// </summary>
+    struct RolloutResult
+    {
+        int Rollouts = 0;
+        double Lines = 0;           // increase of the completed lines counter (see Tetris::GetLinesCompleted)
+        double Survival = 0;        // ratio of the rollouts which reached the horizon without game over
+        double Height = 0;          // stack height at the end
+    };
+
+    /// <summary>
+    /// Headless game for rollouts. It can be loaded from any game of the same size in O(stack height), draws its
+    /// blocks from its own random generator, and places blocks directly at the placements of the PlacementGenerator.
+    /// </summary>
+    class RolloutTetris : public Tetris
+    {
+    public:
+        RolloutTetris(int rows, int cols) : Tetris(&m_RolloutHost, rows, cols)
+        {
+        }
+
+        // Copies the state of the specified game and restarts the random sequence of the next blocks
+        void Load(const Tetris& game, uint64_t seed)
+        {
+            CopyState(game);
+            m_IsPaused = false;
+            m_RolloutHost.Seed(seed);
+        }
+
+        int GetHeight() const { return m_Playfield.GetHeight(); }
+
+        // Collects the placements of the current block, none after game over
+        int GeneratePlacements(std::vector<Placement>& placements)
+        {
+            if (m_pCurrentBlock == NULL || m_GameOver)
+            {
+                placements.clear();
+                return 0;
+            }
+
+            return m_Generator.Generate(m_Playfield, m_pCurrentBlock, placements);
+        }
+
+        // Locks the current block at the specified placement like a touchdown of the game
+        void Place(const Placement& placement)
+        {
+            if (m_pCurrentBlock == NULL || m_GameOver)
+                return;
+
+            m_pCurrentBlock->X = placement.X;
+            m_pCurrentBlock->Y = placement.Y;
+            m_pCurrentBlock->OriIndex = placement.OriIndex;
+
+            PlacementTestResult res;
+            Run(&res, true);
+        }
+
+        // Places the specified number of blocks with the specified policy. Returns the number of placed blocks,
+        // which is less on game over.
+        int Play(int count, RolloutPolicy policy)
+        {
+            for (int i = 0; i < count; i++)
+            {
+                int cnt = GeneratePlacements(m_Placements);
+                if (cnt == 0)
+                    return i;
+
+                Place(m_Placements[ChoosePlacement(cnt, policy)]);
+            }
+
+            return count;
+        }
+
+    protected:
+        HeadlessHost m_RolloutHost;     // constructed after the Tetris base, which only stores its address
+        PlacementGenerator m_Generator;
+        std::vector<Placement> m_Placements;
+
+        int ChoosePlacement(int cnt, RolloutPolicy policy)
+        {
+            if (policy == RolloutRandom)
+                return m_RolloutHost.Random(cnt);
+
+            int best = 0;
+            int ties = 1;
+            for (int i = 1; i < cnt; i++)
+            {
+                if (m_Placements[i].Y < m_Placements[best].Y)
+                {
+                    best = i;
+                    ties = 1;
+                }
+                else if (m_Placements[i].Y == m_Placements[best].Y && m_RolloutHost.Random(++ties) == 0)
+                {
+                    best = i;
+                }
+            }
+
+            return best;
+        }
+    };
+
+    /// <summary>
+    /// Evaluates the candidate placements of the current block by averaging the outcome of rollouts played to a fixed
+    /// horizon with fresh block sequences. The rollouts are distributed among threads; every thread works on its own
+    /// game copy and partial results, the game being evaluated is only read.
+    /// </summary>
+    class MonteCarloEvaluator
+    {
+    public:
+        MonteCarloEvaluator(const RolloutOptions& options = RolloutOptions()) : m_Options(options)
+        {
+        }
+
+        const RolloutOptions& GetOptions() const { return m_Options; }
+        void SetOptions(const RolloutOptions& options) { m_Options = options; }
+
+        // Evaluates the placements of the current block of the specified game, results[i] belongs to candidates[i].
+        // The game must not change during the evaluation.
+        void Evaluate(const Tetris& game, const std::vector<Placement>& candidates, std::vector<RolloutResult>& results)
+        {
+            int threadCount = GetThreadCount();
+            long long itemCount = (long long)candidates.size() * m_Options.Rollouts;
+            if (threadCount > itemCount)
+                threadCount = itemCount > 0 ? (int)itemCount : 1;
+
+            std::vector<std::vector<Totals> > totals(threadCount, std::vector<Totals>(candidates.size()));
+            std::vector<std::thread> threads;
+
+            for (int t = 1; t < threadCount; t++)
+                threads.push_back(std::thread(&MonteCarloEvaluator::RunRollouts, this, std::cref(game),
+                    std::cref(candidates), t, threadCount, std::ref(totals[t])));
+            RunRollouts(game, candidates, 0, threadCount, totals[0]);
+
+            for (size_t t = 0; t < threads.size(); t++)
+                threads[t].join();
+
+            results.assign(candidates.size(), RolloutResult());
+            for (size_t c = 0; c < candidates.size(); c++)
+            {
+                Totals sum;
+                for (int t = 0; t < threadCount; t++)
+                {
+                    sum.Rollouts += totals[t][c].Rollouts;
+                    sum.Lines += totals[t][c].Lines;
+                    sum.Survived += totals[t][c].Survived;
+                    sum.Height += totals[t][c].Height;
+                }
+
+                RolloutResult& r = results[c];
+                r.Rollouts = (int)sum.Rollouts;
+                if (sum.Rollouts > 0)
+                {
+                    r.Lines = (double)sum.Lines / sum.Rollouts;
+                    r.Survival = (double)sum.Survived / sum.Rollouts;
+                    r.Height = (double)sum.Height / sum.Rollouts;
+                }
+            }
+        }
+
+        // Returns the index of the candidate with the best outcome: the highest survival, then the most lines, then
+        // the lowest stack. -1 if there are no candidates.
+        static int GetBest(const std::vector<RolloutResult>& results)
+        {
+            int best = -1;
+            for (int i = 0; i < (int)results.size(); i++)
+            {
+                const RolloutResult& r = results[i];
+                if (best < 0 || r.Survival > results[best].Survival ||
+                    (r.Survival == results[best].Survival && (r.Lines > results[best].Lines ||
+                    (r.Lines == results[best].Lines && r.Height < results[best].Height))))
+                {
+                    best = i;
+                }
+            }
+
+            return best;
+        }
+
+    protected:
+        struct Totals
+        {
+            long long Rollouts = 0;
+            long long Lines = 0;
+            long long Survived = 0;
+            long long Height = 0;
+        };
+
+        RolloutOptions m_Options;
+
+        int GetThreadCount() const
+        {
+            if (m_Options.Threads > 0)
+                return m_Options.Threads;
+
+            unsigned cnt = std::thread::hardware_concurrency();
+            return cnt > 0 ? (int)cnt : 1;
+        }
+
+        // Plays every threadCount-th rollout starting from the specified one. The random sequence of a rollout
+        // depends only on the seed and the index of the rollout.
+        void RunRollouts(const Tetris& game, const std::vector<Placement>& candidates, int first, int threadCount,
+            std::vector<Totals>& totals)
+        {
+            const Playfield& playfield = game.GetPlayfield();
+            RolloutTetris rollout(playfield.GetRows(), playfield.GetColumns());
+            long long itemCount = (long long)candidates.size() * m_Options.Rollouts;
+
+            for (long long i = first; i < itemCount; i += threadCount)
+            {
+                size_t c = (size_t)(i / m_Options.Rollouts);
+
+                rollout.Load(game, m_Options.Seed ^ ((uint64_t)i * 0x9E3779B97F4A7C15ULL));
+                rollout.Place(candidates[c]);
+                int placed = rollout.Play(m_Options.Horizon, m_Options.Policy);
+                bool survived = placed == m_Options.Horizon && !rollout.GetGameOver();
+
+                Totals& t = totals[c];
+                t.Rollouts++;
+                t.Lines += rollout.GetLinesCompleted() - game.GetLinesCompleted();
+                t.Survived += survived ? 1 : 0;
+                t.Height += rollout.GetHeight();
+            }
+        }
+    };
+}
+
+#endif
@@ -0,0 +1,61 @@
+/*
+    Nanochord.Tetris
+
+    Rotation systems with wall kick tables for Playfield::SetRotationSystem
+
+    MIT License - see Tetris.h for details.
+ */
+
+#ifndef _Nanochord_TetrisRotation_
+#define _Nanochord_TetrisRotation_
+
+#include "Tetris.h"
+
+namespace Nanochord
+{
+    /// <summary>
+    /// The wall kicks of the Super Rotation System. The game rotates counter-clockwise and its orientations 0, 1, 2
+    /// and 3 correspond to the SRS states 2, R, 0 and L (the I, S and Z blocks have only the first two), so the
+    /// tables are the SRS counter-clockwise ones: 2->R, R->0, 0->L and L->2. Every kick is tried in order regardless
+    /// of the reason of the collision, and the block can also be kicked up or down by up to two rows.
+    /// The bitmaps and the centers of the blocks are the ones of this game, so the resulting positions are the same
+    /// as the guideline only where the shapes share their reference cell.
+    /// </summary>
+    class SrsRotationSystem : public RotationSystem
+    {
+    public:
+        static const int KickCount = 5;
+
+        SrsRotationSystem()
+        {
+        }
+
+        int GetKicks(const Block* pBlock, byte fromIndex, byte toIndex, const WallKick*& pKicks) const override
+        {
+            static const WallKick jlstzKicks[4][KickCount] =
+            {
+                { { 0, 0, KickAlways }, { -1, 0, KickAlways }, { -1, 1, KickAlways }, { 0, -2, KickAlways }, { -1, -2, KickAlways } },  // 2->R
+                { { 0, 0, KickAlways }, { 1, 0, KickAlways }, { 1, -1, KickAlways }, { 0, 2, KickAlways }, { 1, 2, KickAlways } },      // R->0
+                { { 0, 0, KickAlways }, { 1, 0, KickAlways }, { 1, 1, KickAlways }, { 0, -2, KickAlways }, { 1, -2, KickAlways } },     // 0->L
+                { { 0, 0, KickAlways }, { -1, 0, KickAlways }, { -1, -1, KickAlways }, { 0, 2, KickAlways }, { -1, 2, KickAlways } }    // L->2
+            };
+            static const WallKick iKicks[4][KickCount] =
+            {
+                { { 0, 0, KickAlways }, { 1, 0, KickAlways }, { -2, 0, KickAlways }, { 1, -2, KickAlways }, { -2, 1, KickAlways } },    // 2->R
+                { { 0, 0, KickAlways }, { 2, 0, KickAlways }, { -1, 0, KickAlways }, { 2, 1, KickAlways }, { -1, -2, KickAlways } },    // R->0
+                { { 0, 0, KickAlways }, { -1, 0, KickAlways }, { 2, 0, KickAlways }, { -1, 2, KickAlways }, { 2, -1, KickAlways } },    // 0->L
+                { { 0, 0, KickAlways }, { -2, 0, KickAlways }, { 1, 0, KickAlways }, { -2, -1, KickAlways }, { 1, 2, KickAlways } }     // L->2
+            };
+
+            // A block with two orientations turns back from the state R as if it went to the state 0
+            (void)toIndex;
+            pKicks = pBlock->IsI ? iKicks[fromIndex & 3] : jlstzKicks[fromIndex & 3];
+            return KickCount;
+        }
+
+        int GetMaxKickDown() const override { return 2; }
+        int GetMaxKickUp() const override { return 2; }
+    };
+}
+
+#endif
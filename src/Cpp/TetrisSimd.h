@@ -0,0 +1,226 @@
+/*
+    Nanochord.Tetris
+
+    Vectorized full row test for playfields with a byte per cell: AVX2, SSE2 and a portable 64-bit fallback, the
+    fastest one supported by the CPU is selected at runtime
+
+    MIT License - see Tetris.h for details.
+
+    Define TETRIS_SIMD before including Tetris.h to use the selected kernel in Playfield::IsRowFull (and so in
+    GetCompletedRows). The kernels can also be called directly, e.g. by benchmarks.
+ */
+
+#ifndef _Nanochord_TetrisSimd_
+#define _Nanochord_TetrisSimd_
+
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(_M_X64) || (defined(__i386__) && defined(__SSE2__)) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define TETRIS_SIMD_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+#if defined(TETRIS_SIMD_X86) && (defined(__GNUC__) || defined(__clang__))
+#define TETRIS_SIMD_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define TETRIS_SIMD_TARGET_AVX2
+#endif
+
+namespace Nanochord
+{
+    enum RowKernelKind
+    {
+        RowKernelScalar,
+        RowKernelSse2,
+        RowKernelAvx2
+    };
+
+    /// <summary>
+    /// Tests whether a row of cells (a byte per cell, 0 means empty) is complete. Every kernel reads exactly the
+    /// cells of the row: the tail of a row which is not a multiple of the vector width is tested with a last vector
+    /// which overlaps the previous one, and rows narrower than a vector go to the narrower kernel.
+    /// </summary>
+    class RowKernel
+    {
+    public:
+        typedef bool (*IsRowFullFunction)(const unsigned char* row, int cols);
+
+        // Tests the row with the kernel selected for this CPU
+        static bool IsRowFull(const unsigned char* row, int cols)
+        {
+            return GetFunction()(row, cols);
+        }
+
+        // Returns the kernel used by IsRowFull
+        static RowKernelKind GetKind()
+        {
+            return GetSelection().Kind;
+        }
+
+        static const char* GetName(RowKernelKind kind)
+        {
+            return kind == RowKernelAvx2 ? "AVX2" : kind == RowKernelSse2 ? "SSE2" : "Scalar";
+        }
+
+        // Tells whether the CPU can run the specified kernel
+        static bool IsSupported(RowKernelKind kind)
+        {
+            if (kind == RowKernelScalar)
+                return true;
+#ifdef TETRIS_SIMD_X86
+            if (kind == RowKernelSse2)
+                return true;
+            return HasAvx2();
+#else
+            return false;
+#endif
+        }
+
+        // Returns the specified kernel, or NULL if it is not compiled in
+        static IsRowFullFunction GetFunction(RowKernelKind kind)
+        {
+            switch (kind)
+            {
+            case RowKernelScalar:
+                return IsRowFullScalar;
+#ifdef TETRIS_SIMD_X86
+            case RowKernelSse2:
+                return IsRowFullSse2;
+            case RowKernelAvx2:
+                return IsRowFullAvx2;
+#endif
+            default:
+                return NULL;
+            }
+        }
+
+        // Portable kernel: 8 cells at a time, a word contains an empty cell if it has a zero byte
+        static bool IsRowFullScalar(const unsigned char* row, int cols)
+        {
+            if (cols < 8)
+            {
+                for (int x = 0; x < cols; x++)
+                    if (row[x] == 0)
+                        return false;
+
+                return true;
+            }
+
+            for (int x = 0; x < cols - 8; x += 8)
+                if (HasZeroByte(Load64(row + x)))
+                    return false;
+
+            return !HasZeroByte(Load64(row + cols - 8));
+        }
+
+#ifdef TETRIS_SIMD_X86
+        static bool IsRowFullSse2(const unsigned char* row, int cols)
+        {
+            if (cols < 16)
+                return IsRowFullScalar(row, cols);
+
+            const __m128i zero = _mm_setzero_si128();
+
+            for (int x = 0; x < cols - 16; x += 16)
+            {
+                __m128i cells = _mm_loadu_si128((const __m128i*)(row + x));
+                if (_mm_movemask_epi8(_mm_cmpeq_epi8(cells, zero)) != 0)
+                    return false;
+            }
+
+            __m128i last = _mm_loadu_si128((const __m128i*)(row + cols - 16));
+            return _mm_movemask_epi8(_mm_cmpeq_epi8(last, zero)) == 0;
+        }
+
+        TETRIS_SIMD_TARGET_AVX2
+        static bool IsRowFullAvx2(const unsigned char* row, int cols)
+        {
+            if (cols < 32)
+                return IsRowFullSse2(row, cols);
+
+            const __m256i zero = _mm256_setzero_si256();
+
+            for (int x = 0; x < cols - 32; x += 32)
+            {
+                __m256i cells = _mm256_loadu_si256((const __m256i*)(row + x));
+                if (_mm256_movemask_epi8(_mm256_cmpeq_epi8(cells, zero)) != 0)
+                    return false;
+            }
+
+            __m256i last = _mm256_loadu_si256((const __m256i*)(row + cols - 32));
+            return _mm256_movemask_epi8(_mm256_cmpeq_epi8(last, zero)) == 0;
+        }
+#endif
+
+    protected:
+        struct Selection
+        {
+            RowKernelKind Kind;
+            IsRowFullFunction Function;
+        };
+
+        static uint64_t Load64(const unsigned char* p)
+        {
+            uint64_t v;
+            memcpy(&v, p, sizeof(v));
+            return v;
+        }
+
+        static bool HasZeroByte(uint64_t v)
+        {
+            return ((v - 0x0101010101010101ULL) & ~v & 0x8080808080808080ULL) != 0;
+        }
+
+#ifdef TETRIS_SIMD_X86
+        static bool HasAvx2()
+        {
+#if defined(__GNUC__) || defined(__clang__)
+            return __builtin_cpu_supports("avx2") != 0;
+#elif defined(_MSC_VER)
+            // AVX2 also needs the OS to save the YMM registers (OSXSAVE and XCR0)
+            int info[4];
+            __cpuid(info, 0);
+            if (info[0] < 7)
+                return false;
+
+            __cpuid(info, 1);
+            if ((info[2] & (1 << 27)) == 0 || (info[2] & (1 << 28)) == 0 || (_xgetbv(0) & 6) != 6)
+                return false;
+
+            __cpuidex(info, 7, 0);
+            return (info[1] & (1 << 5)) != 0;
+#else
+            return false;
+#endif
+        }
+#endif
+
+        static Selection Select()
+        {
+            Selection selection = { RowKernelScalar, IsRowFullScalar };
+#ifdef TETRIS_SIMD_X86
+            selection.Kind = HasAvx2() ? RowKernelAvx2 : RowKernelSse2;
+            selection.Function = GetFunction(selection.Kind);
+#endif
+            return selection;
+        }
+
+        // The CPU is examined once, at the first call (thread-safe since C++11)
+        static const Selection& GetSelection()
+        {
+            static const Selection selection = Select();
+            return selection;
+        }
+
+        static IsRowFullFunction GetFunction()
+        {
+            return GetSelection().Function;
+        }
+    };
+}
+
+#endif
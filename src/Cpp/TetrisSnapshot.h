@@ -0,0 +1,255 @@
+/*
+    Nanochord.Tetris
+
+    Immutable frame snapshots for rendering the game on a separate thread
+
+    MIT License - see Tetris.h for details.
+ */
+
+#ifndef _Nanochord_TetrisSnapshot_
+#define _Nanochord_TetrisSnapshot_
+
+#include "Tetris.h"
+#include <string.h>
+#include <atomic>
+#include <vector>
+
+namespace Nanochord
+{
+    /// <summary>
+    /// Wait-free single producer / single consumer triple buffer.
+    /// The writer always has a private back slot, the reader always has a private front slot, and the third slot is
+    /// exchanged between them atomically, so neither side ever blocks or sees a half-written value.
+    /// </summary>
+    template <class T>
+    class TripleBuffer
+    {
+    public:
+        TripleBuffer()
+        {
+            m_Back = 0;
+            m_Front = 1;
+            m_State.store(2);
+        }
+
+        // Gives access to every slot, e.g. to preallocate them before the buffer is shared between threads
+        T& GetSlot(int index) { return m_Slots[index]; }
+
+        // Returns the slot which can be filled by the writer
+        T& GetWriteBuffer() { return m_Slots[m_Back]; }
+
+        // Makes the content of the write buffer the latest published value
+        void Publish()
+        {
+            unsigned prev = m_State.exchange(m_Back | FreshFlag, std::memory_order_acq_rel);
+            m_Back = prev & IndexMask;
+        }
+
+        // Tells whether a value was published since the last Read
+        bool HasNewData() const
+        {
+            return (m_State.load(std::memory_order_acquire) & FreshFlag) != 0;
+        }
+
+        // Returns the latest published value. The reference stays valid until the next Read call.
+        const T& Read()
+        {
+            if (HasNewData())
+            {
+                unsigned prev = m_State.exchange(m_Front, std::memory_order_acq_rel);
+                m_Front = prev & IndexMask;
+            }
+
+            return m_Slots[m_Front];
+        }
+
+    protected:
+        static const unsigned IndexMask = 0x3;
+        static const unsigned FreshFlag = 0x4;
+
+        T m_Slots[3];
+        unsigned m_Back;
+        unsigned m_Front;
+        std::atomic<unsigned> m_State;
+    };
+
+    /// <summary>
+    /// Copy of a block as it was at the time of the snapshot
+    /// </summary>
+    struct BlockSnapshot
+    {
+        bool IsValid = false;
+        int X = 0;
+        int Y = 0;
+        byte OriIndex = 0;
+        byte Color = 0;
+        byte Bitmap[4] = { 0 };
+
+        void Assign(const Block* pBlock)
+        {
+            IsValid = pBlock != NULL;
+            if (!IsValid)
+                return;
+
+            const byte* bmp = pBlock->GetCurrentBitmap();
+
+            X = pBlock->X;
+            Y = pBlock->Y;
+            OriIndex = pBlock->OriIndex;
+            Color = pBlock->Color;
+            for (int i = 0; i < 4; i++)
+                Bitmap[i] = bmp[i];
+        }
+    };
+
+    /// <summary>
+    /// Compact and self-contained copy of a game frame
+    /// </summary>
+    struct FrameSnapshot
+    {
+        unsigned long Sequence = 0;
+        int Rows = 0;
+        int Columns = 0;
+        int Height = 0;                 // the rows at and above this one are empty
+        std::vector<byte> Cells;        // row-major, row 0 is the bottom row of the playfield
+        BlockSnapshot CurrentBlock;
+        BlockSnapshot NextBlock;
+        byte ActualLevel = 1;
+        int ActualPoints = 0;
+        int LinesCompleted = 0;
+        bool IsPaused = false;
+        bool GameOver = false;
+
+        byte GetCell(int x, int y) const { return Cells[y * Columns + x]; }
+    };
+
+    /// <summary>
+    /// Tetris game which publishes a FrameSnapshot after every tick and every player action.
+    /// The game logic has to be driven from one thread, while another thread can call ReadSnapshot at any time.
+    /// </summary>
+    class SnapshotTetris : public Tetris
+    {
+    public:
+        SnapshotTetris(Host* pHost, int rows, int cols) : Tetris(pHost, rows, cols)
+        {
+            InitSnapshots();
+        }
+
+        SnapshotTetris(Host* pHost, Playfield* pPlayfield) : Tetris(pHost, pPlayfield)
+        {
+            InitSnapshots();
+        }
+
+        // Returns the latest published frame (render thread)
+        const FrameSnapshot& ReadSnapshot() { return m_Snapshots.Read(); }
+
+        // Tells whether a new frame was published since the last ReadSnapshot call (render thread)
+        bool HasNewSnapshot() const { return m_Snapshots.HasNewData(); }
+
+        int Start() override
+        {
+            int res = Tetris::Start();
+            PublishSnapshot();
+            return res;
+        }
+
+        int Run() override
+        {
+            int res = Tetris::Run();
+            PublishSnapshot();
+            return res;
+        }
+
+        void Pause() override
+        {
+            Tetris::Pause();
+            PublishSnapshot();
+        }
+
+        void MoveLeft() override
+        {
+            Tetris::MoveLeft();
+            PublishSnapshot();
+        }
+
+        void MoveRight() override
+        {
+            Tetris::MoveRight();
+            PublishSnapshot();
+        }
+
+        void Rotate() override
+        {
+            Tetris::Rotate();
+            PublishSnapshot();
+        }
+
+        int Drop() override
+        {
+            int res = Tetris::Drop();
+            PublishSnapshot();
+            return res;
+        }
+
+    protected:
+        using Tetris::Run;
+
+        TripleBuffer<FrameSnapshot> m_Snapshots;
+        unsigned long m_Sequence;
+
+        void InitSnapshots()
+        {
+            m_Sequence = 0;
+
+            // All the allocations are done here, publishing a frame never allocates
+            for (int i = 0; i < 3; i++)
+            {
+                FrameSnapshot& frame = m_Snapshots.GetSlot(i);
+                frame.Rows = m_Playfield.GetRows();
+                frame.Columns = m_Playfield.GetColumns();
+                frame.Cells.assign(frame.Rows * frame.Columns, 0);
+            }
+        }
+
+        // Captures the current state of the game into the write buffer and publishes it
+        virtual void PublishSnapshot()
+        {
+            FrameSnapshot& frame = m_Snapshots.GetWriteBuffer();
+
+            // Only the stack is copied. The rows above it are cleared only if they were occupied in this slot.
+            int height = m_Playfield.GetHeight();
+            if (frame.Height > height)
+                memset(&frame.Cells[height * frame.Columns], 0, (frame.Height - height) * frame.Columns);
+            frame.Height = height;
+
+            byte* pCell = frame.Cells.data();
+            for (int y = 0; y < height; y++)
+            {
+                if (m_Playfield.Map != NULL)
+                {
+                    const byte* pRow = m_Playfield.Map[y];
+                    for (int x = 0; x < frame.Columns; x++)
+                        *pCell++ = pRow[x];
+                }
+                else
+                {
+                    for (int x = 0; x < frame.Columns; x++)
+                        *pCell++ = m_Playfield.GetCell(x, y);
+                }
+            }
+
+            frame.Sequence = ++m_Sequence;
+            frame.CurrentBlock.Assign(m_pCurrentBlock);
+            frame.NextBlock.Assign(m_pNextBlock);
+            frame.ActualLevel = m_ActualLevel;
+            frame.ActualPoints = m_ActualPoints;
+            frame.LinesCompleted = m_LinesCompleted;
+            frame.IsPaused = m_IsPaused;
+            frame.GameOver = m_GameOver;
+
+            m_Snapshots.Publish();
+        }
+    };
+}
+
+#endif
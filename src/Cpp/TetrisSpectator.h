@@ -0,0 +1,681 @@
+/*
+    Nanochord.Tetris
+
+    Delta-encoded spectator stream for broadcasting a game to many observers
+
+    MIT License - see Tetris.h for details.
+ */
+
+#ifndef _Nanochord_TetrisSpectator_
+#define _Nanochord_TetrisSpectator_
+
+#include "Tetris.h"
+#include "TetrisSnapshot.h"
+#include <string.h>
+#include <memory>
+#include <vector>
+
+namespace Nanochord
+{
+    /// <summary>
+    /// An encoded frame of the spectator stream. The buffer is immutable once published, so the same packet can be
+    /// given to any number of subscribers (and threads) without copying or encoding it again.
+    /// </summary>
+    typedef std::shared_ptr<const std::vector<byte> > SpectatorPacket;
+
+    /// <summary>
+    /// The format of the stream. Every packet starts with its kind and a sequence number; the numbers are varints
+    /// (7 bits per byte, low bits first), the signed ones are zigzag encoded.
+    ///  - keyframe: rows, columns, stack height, the cells of the stack run-length encoded as (count, color) pairs,
+    ///    then a block and a counters record.
+    ///  - delta: records until SpectatorEnd. A lock record is a block which touched down (color, x, y, orientation)
+    ///    followed by the rows it completed; the pose record moves the current block relative to its previous pose.
+    /// A delta applies to the frame of the previous sequence number only, a decoder which missed a packet waits for
+    /// the next keyframe.
+    /// </summary>
+    enum SpectatorTag
+    {
+        SpectatorEnd,
+        SpectatorKeyframe,
+        SpectatorDelta,
+        SpectatorLock,
+        SpectatorPose,
+        SpectatorBlocks,
+        SpectatorCounters
+    };
+
+    /// <summary>
+    /// Game which encodes its changes for spectators. Call EncodeFrame once per displayed frame (e.g. after the
+    /// ticks and the player actions of the frame): it returns a keyframe at the start of every game and every
+    /// keyframe interval, otherwise a delta of the touchdowns, the pose of the current block, the blocks and the
+    /// counters which changed since the previous packet, or an empty packet if nothing changed.
+    /// </summary>
+    class SpectatorTetris : public Tetris
+    {
+    public:
+        SpectatorTetris(Host* pHost, int rows, int cols, int keyframeInterval = 60) : Tetris(pHost, rows, cols)
+        {
+            InitEncoder(keyframeInterval);
+        }
+
+        SpectatorTetris(Host* pHost, Playfield* pPlayfield, int keyframeInterval = 60) : Tetris(pHost, pPlayfield)
+        {
+            InitEncoder(keyframeInterval);
+        }
+
+        using Tetris::Run;
+
+        int Start() override
+        {
+            int res = Tetris::Start();
+            m_Locks.clear();
+            RequestKeyframe();
+            return res;
+        }
+
+        // The number of frames between two keyframes, 0 means only at the start of the games and when requested
+        int GetKeyframeInterval() const { return m_KeyframeInterval; }
+        void SetKeyframeInterval(int frames) { m_KeyframeInterval = frames; }
+
+        // Makes the next packet a keyframe, e.g. when a subscriber joins
+        void RequestKeyframe() { m_KeyframeRequested = true; }
+
+        // Statistics of the encoded packets
+        unsigned long GetPacketCount() const { return m_PacketCount; }
+        unsigned long GetKeyframeCount() const { return m_KeyframeCount; }
+        unsigned long long GetEncodedBytes() const { return m_EncodedBytes; }
+
+        // Encodes the changes since the previous packet
+        SpectatorPacket EncodeFrame()
+        {
+            bool keyframe = m_KeyframeRequested || (m_KeyframeInterval > 0 && m_FramesSinceKeyframe >= m_KeyframeInterval);
+            m_FramesSinceKeyframe++;
+
+            if (!keyframe && m_Locks.empty() && !HasBlocksChanged() && !HasPoseChanged() && !HasCountersChanged())
+                return SpectatorPacket();
+
+            std::vector<byte>* pData = new std::vector<byte>();
+            SpectatorPacket packet(pData);
+            std::vector<byte>& data = *pData;
+            data.reserve(keyframe ? 16 + m_Playfield.GetHeight() * 4 : 16 + m_Locks.size());
+
+            data.push_back((byte)(keyframe ? SpectatorKeyframe : SpectatorDelta));
+            WriteVarint(data, (unsigned long)++m_Sequence);
+
+            if (keyframe)
+            {
+                WriteKeyframe(data);
+                m_KeyframeRequested = false;
+                m_FramesSinceKeyframe = 0;
+                m_KeyframeCount++;
+            }
+            else
+            {
+                data.insert(data.end(), m_Locks.begin(), m_Locks.end());
+
+                if (HasBlocksChanged())
+                    WriteBlocks(data);
+                else if (HasPoseChanged())
+                    WritePose(data);
+
+                if (HasCountersChanged())
+                    WriteCounters(data);
+
+                data.push_back((byte)SpectatorEnd);
+            }
+
+            m_Locks.clear();
+            m_PacketCount++;
+            m_EncodedBytes += data.size();
+            return packet;
+        }
+
+    protected:
+        int m_KeyframeInterval;
+        int m_FramesSinceKeyframe;
+        bool m_KeyframeRequested;
+        unsigned long m_Sequence;
+        std::vector<byte> m_Locks;          // the lock records of the touchdowns since the previous packet
+        BlockSnapshot m_SentCurrent;        // the state the spectators have
+        BlockSnapshot m_SentNext;
+        byte m_SentLevel;
+        int m_SentPoints;
+        int m_SentLines;
+        byte m_SentFlags;
+        unsigned long m_PacketCount;
+        unsigned long m_KeyframeCount;
+        unsigned long long m_EncodedBytes;
+
+        void InitEncoder(int keyframeInterval)
+        {
+            m_KeyframeInterval = keyframeInterval;
+            m_FramesSinceKeyframe = 0;
+            m_KeyframeRequested = true;
+            m_Sequence = 0;
+            m_SentLevel = 0;
+            m_SentPoints = 0;
+            m_SentLines = 0;
+            m_SentFlags = 0;
+            m_PacketCount = 0;
+            m_KeyframeCount = 0;
+            m_EncodedBytes = 0;
+        }
+
+        // Records the touchdown of the current block and the rows it completes
+        PlacementTestResult DoRun() override
+        {
+            const Block* pBlock = m_pCurrentBlock;
+            byte color = pBlock->Color;
+            int x = pBlock->X;
+            int y = pBlock->Y;
+            byte oriIndex = pBlock->OriIndex;
+
+            PlacementTestResult res = Tetris::DoRun();
+            if (res == PlacementTestResult::Succeeded)
+                return res;
+
+            // The game removes the same rows right after this
+            int cnt = m_Playfield.GetCompletedRows();
+
+            m_Locks.push_back((byte)SpectatorLock);
+            m_Locks.push_back(color);
+            WriteSigned(m_Locks, x);
+            WriteSigned(m_Locks, y);
+            m_Locks.push_back(oriIndex);
+            m_Locks.push_back((byte)cnt);
+            for (int i = 0; i < cnt; i++)
+                WriteVarint(m_Locks, (unsigned long)m_Playfield.CompletedLines[i]);
+
+            return res;
+        }
+
+        byte GetFlags() const
+        {
+            return (byte)((m_IsPaused ? 1 : 0) | (m_GameOver ? 2 : 0));
+        }
+
+        static bool IsSameBlock(const BlockSnapshot& sent, const Block* pBlock)
+        {
+            return pBlock == NULL ? !sent.IsValid : sent.IsValid && sent.Color == pBlock->Color;
+        }
+
+        // A new current block (after a touchdown or a new game) is sent with the next block
+        bool HasBlocksChanged() const
+        {
+            return !IsSameBlock(m_SentCurrent, m_pCurrentBlock) || !IsSameBlock(m_SentNext, m_pNextBlock) ||
+                (m_pNextBlock != NULL && m_SentNext.X != m_pNextBlock->X) || !m_Locks.empty();
+        }
+
+        bool HasPoseChanged() const
+        {
+            return m_pCurrentBlock != NULL && (m_SentCurrent.X != m_pCurrentBlock->X || m_SentCurrent.Y != m_pCurrentBlock->Y ||
+                m_SentCurrent.OriIndex != m_pCurrentBlock->OriIndex);
+        }
+
+        bool HasCountersChanged() const
+        {
+            return m_SentLevel != m_ActualLevel || m_SentPoints != m_ActualPoints || m_SentLines != m_LinesCompleted ||
+                m_SentFlags != GetFlags();
+        }
+
+        void WriteBlock(std::vector<byte>& data, const Block* pBlock)
+        {
+            if (pBlock == NULL)
+            {
+                data.push_back(0);
+                return;
+            }
+
+            data.push_back(pBlock->Color);
+            WriteSigned(data, pBlock->X);
+            WriteSigned(data, pBlock->Y);
+            data.push_back(pBlock->OriIndex);
+        }
+
+        void WriteBlocks(std::vector<byte>& data)
+        {
+            data.push_back((byte)SpectatorBlocks);
+            WriteBlock(data, m_pCurrentBlock);
+            WriteBlock(data, m_pNextBlock);
+
+            m_SentCurrent.Assign(m_pCurrentBlock);
+            m_SentNext.Assign(m_pNextBlock);
+        }
+
+        void WritePose(std::vector<byte>& data)
+        {
+            data.push_back((byte)SpectatorPose);
+            WriteSigned(data, m_pCurrentBlock->X - m_SentCurrent.X);
+            WriteSigned(data, m_pCurrentBlock->Y - m_SentCurrent.Y);
+            data.push_back(m_pCurrentBlock->OriIndex);
+
+            m_SentCurrent.Assign(m_pCurrentBlock);
+        }
+
+        void WriteCounters(std::vector<byte>& data)
+        {
+            data.push_back((byte)SpectatorCounters);
+            data.push_back(m_ActualLevel);
+            WriteVarint(data, (unsigned long)m_ActualPoints);
+            WriteVarint(data, (unsigned long)m_LinesCompleted);
+            data.push_back(GetFlags());
+
+            m_SentLevel = m_ActualLevel;
+            m_SentPoints = m_ActualPoints;
+            m_SentLines = m_LinesCompleted;
+            m_SentFlags = GetFlags();
+        }
+
+        void WriteKeyframe(std::vector<byte>& data)
+        {
+            int rows = m_Playfield.GetRows();
+            int cols = m_Playfield.GetColumns();
+            int height = m_Playfield.GetHeight();
+
+            WriteVarint(data, (unsigned long)rows);
+            WriteVarint(data, (unsigned long)cols);
+            WriteVarint(data, (unsigned long)height);
+
+            // Runs of the same color in row-major order from the bottom row
+            unsigned long run = 0;
+            byte runColor = 0;
+            for (int y = 0; y < height; y++)
+            {
+                for (int x = 0; x < cols; x++)
+                {
+                    byte color = m_Playfield.Map != NULL ? m_Playfield.Map[y][x] : m_Playfield.GetCell(x, y);
+                    if (run > 0 && color != runColor)
+                    {
+                        WriteVarint(data, run);
+                        data.push_back(runColor);
+                        run = 0;
+                    }
+                    runColor = color;
+                    run++;
+                }
+            }
+            if (run > 0)
+            {
+                WriteVarint(data, run);
+                data.push_back(runColor);
+            }
+
+            WriteBlocks(data);
+            WriteCounters(data);
+            data.push_back((byte)SpectatorEnd);
+        }
+
+        static void WriteVarint(std::vector<byte>& data, unsigned long value)
+        {
+            while (value >= 0x80)
+            {
+                data.push_back((byte)(value | 0x80));
+                value >>= 7;
+            }
+            data.push_back((byte)value);
+        }
+
+        static void WriteSigned(std::vector<byte>& data, int value)
+        {
+            WriteVarint(data, value < 0 ? ((unsigned long)(-(long)value) << 1) - 1 : (unsigned long)value << 1);
+        }
+    };
+
+    /// <summary>
+    /// Receives the packets of a SpectatorChannel
+    /// </summary>
+    class SpectatorSubscriber
+    {
+    public:
+        virtual ~SpectatorSubscriber() {}
+
+        virtual void OnPacket(const SpectatorPacket& packet) = 0;
+    };
+
+    /// <summary>
+    /// Broadcasts the packets of a game to its subscribers. Every subscriber gets the same immutable packet. The
+    /// channel keeps the last keyframe and the deltas after it, so a subscriber which joins during the game gets
+    /// them first and can display the current frame right away.
+    /// </summary>
+    class SpectatorChannel
+    {
+    public:
+        void Subscribe(SpectatorSubscriber* pSubscriber)
+        {
+            m_Subscribers.push_back(pSubscriber);
+            for (size_t i = 0; i < m_Backlog.size(); i++)
+                pSubscriber->OnPacket(m_Backlog[i]);
+        }
+
+        void Unsubscribe(SpectatorSubscriber* pSubscriber)
+        {
+            for (size_t i = 0; i < m_Subscribers.size(); i++)
+            {
+                if (m_Subscribers[i] == pSubscriber)
+                {
+                    m_Subscribers.erase(m_Subscribers.begin() + i);
+                    return;
+                }
+            }
+        }
+
+        int GetSubscriberCount() const { return (int)m_Subscribers.size(); }
+
+        // Sends the packet to every subscriber, empty packets are skipped
+        void Publish(const SpectatorPacket& packet)
+        {
+            if (!packet || packet->empty())
+                return;
+
+            if ((*packet)[0] == SpectatorKeyframe)
+                m_Backlog.clear();
+            m_Backlog.push_back(packet);
+
+            for (size_t i = 0; i < m_Subscribers.size(); i++)
+                m_Subscribers[i]->OnPacket(packet);
+        }
+
+    protected:
+        std::vector<SpectatorSubscriber*> m_Subscribers;
+        std::vector<SpectatorPacket> m_Backlog;
+    };
+
+    /// <summary>
+    /// Rebuilds the frames of a game from its spectator stream
+    /// </summary>
+    class SpectatorDecoder : public SpectatorSubscriber
+    {
+    public:
+        SpectatorDecoder()
+        {
+            m_IsSynchronized = false;
+            m_pData = NULL;
+            m_pEnd = NULL;
+        }
+
+        // Tells whether the decoder has a keyframe and every packet after it
+        bool IsSynchronized() const { return m_IsSynchronized; }
+
+        // The frame of the last decoded packet
+        const FrameSnapshot& GetFrame() const { return m_Frame; }
+
+        void OnPacket(const SpectatorPacket& packet) override
+        {
+            if (packet)
+                Decode(packet->data(), packet->size());
+        }
+
+        // Applies a packet to the frame. Returns false if the packet is malformed or does not follow the previous
+        // one; the decoder then ignores the deltas until the next keyframe.
+        bool Decode(const byte* data, size_t size)
+        {
+            m_pData = data;
+            m_pEnd = data + size;
+
+            byte kind = 0;
+            unsigned long sequence = 0;
+            if (!ReadByte(kind) || !ReadVarint(sequence))
+                return false;
+
+            if (kind == SpectatorKeyframe)
+            {
+                m_IsSynchronized = ReadKeyframe();
+            }
+            else if (kind != SpectatorDelta || !m_IsSynchronized || sequence != m_Frame.Sequence + 1)
+            {
+                m_IsSynchronized = false;
+                return false;
+            }
+
+            m_IsSynchronized = m_IsSynchronized && ReadRecords();
+            m_Frame.Sequence = sequence;
+            return m_IsSynchronized;
+        }
+
+    protected:
+        FrameSnapshot m_Frame;
+        bool m_IsSynchronized;
+        const byte* m_pData;
+        const byte* m_pEnd;
+
+        // Returns a block of the specified color (1-7) to look up its bitmaps, or NULL. The blocks are shared by
+        // every decoder and never modified.
+        static const Block* GetBlock(byte color)
+        {
+            static const Block_O o;
+            static const Block_I i;
+            static const Block_S s;
+            static const Block_Z z;
+            static const Block_L l;
+            static const Block_J j;
+            static const Block_T t;
+            static const Block* const blocks[7] = { &o, &i, &s, &z, &l, &j, &t };
+
+            return color >= 1 && color <= 7 ? blocks[color - 1] : NULL;
+        }
+
+        // Sets the snapshot to a block of the specified color and pose. Returns false if there is no such block.
+        static bool SetBlock(BlockSnapshot& snapshot, byte color, int x, int y, byte oriIndex)
+        {
+            const Block* pBlock = GetBlock(color);
+            if (pBlock == NULL || oriIndex >= pBlock->OriCount)
+                return false;
+
+            snapshot.IsValid = true;
+            snapshot.X = x;
+            snapshot.Y = y;
+            snapshot.OriIndex = oriIndex;
+            snapshot.Color = color;
+            for (int i = 0; i < 4; i++)
+                snapshot.Bitmap[i] = pBlock->OriBitmaps[oriIndex][i];
+
+            return true;
+        }
+
+        bool ReadByte(byte& value)
+        {
+            if (m_pData >= m_pEnd)
+                return false;
+
+            value = *m_pData++;
+            return true;
+        }
+
+        bool ReadVarint(unsigned long& value)
+        {
+            // Bits beyond the width of the value make the packet malformed
+            value = 0;
+            for (int shift = 0; shift < (int)sizeof(value) * 8; shift += 7)
+            {
+                byte b = 0;
+                if (!ReadByte(b))
+                    return false;
+
+                value |= (unsigned long)(b & 0x7F) << shift;
+                if ((b & 0x80) == 0)
+                    return true;
+            }
+
+            return false;
+        }
+
+        bool ReadSigned(int& value)
+        {
+            unsigned long v = 0;
+            if (!ReadVarint(v) || v > 0xFFFFFFFFUL)
+                return false;
+
+            value = (v & 1) != 0 ? -(int)((v + 1) >> 1) : (int)(v >> 1);
+            return true;
+        }
+
+        bool ReadBlock(BlockSnapshot& snapshot)
+        {
+            byte color = 0;
+            if (!ReadByte(color))
+                return false;
+
+            if (color == 0)
+            {
+                snapshot.IsValid = false;
+                return true;
+            }
+
+            int x = 0;
+            int y = 0;
+            byte oriIndex = 0;
+            return ReadSigned(x) && ReadSigned(y) && ReadByte(oriIndex) && SetBlock(snapshot, color, x, y, oriIndex);
+        }
+
+        bool ReadKeyframe()
+        {
+            unsigned long rows = 0;
+            unsigned long cols = 0;
+            unsigned long height = 0;
+            if (!ReadVarint(rows) || !ReadVarint(cols) || !ReadVarint(height) || height > rows)
+                return false;
+
+            // Bounds the board before its cells are allocated, so the cell count cannot overflow
+            if (rows == 0 || cols == 0 || rows > 0xFFFF || cols > 0xFFFF || rows * cols > 0x7FFFFFFFUL)
+                return false;
+
+            if ((int)rows != m_Frame.Rows || (int)cols != m_Frame.Columns)
+            {
+                m_Frame.Rows = (int)rows;
+                m_Frame.Columns = (int)cols;
+                m_Frame.Cells.assign(rows * cols, 0);
+                m_Frame.Height = 0;
+            }
+            else if (m_Frame.Height > 0)
+            {
+                memset(m_Frame.Cells.data(), 0, m_Frame.Height * cols);
+            }
+
+            size_t cellCount = height * cols;
+            size_t i = 0;
+            while (i < cellCount)
+            {
+                unsigned long run = 0;
+                byte color = 0;
+                if (!ReadVarint(run) || !ReadByte(color) || run == 0 || run > cellCount - i)
+                    return false;
+
+                memset(&m_Frame.Cells[i], color, run);
+                i += run;
+            }
+
+            m_Frame.Height = (int)height;
+            return true;
+        }
+
+        // Occupies the cells of a locked block and removes the rows it completed
+        bool ReadLock()
+        {
+            byte color = 0;
+            int x = 0;
+            int y = 0;
+            byte oriIndex = 0;
+            byte cnt = 0;
+            if (!ReadByte(color) || !ReadSigned(x) || !ReadSigned(y) || !ReadByte(oriIndex) || !ReadByte(cnt) || cnt > 4)
+                return false;
+
+            const Block* pBlock = GetBlock(color);
+            if (pBlock == NULL || oriIndex >= pBlock->OriCount)
+                return false;
+
+            const byte* bmp = pBlock->OriBitmaps[oriIndex];
+            for (int i = 0; i < 4; i++)
+            {
+                int yy = y + 1 - i;
+                if (yy < 0 || yy >= m_Frame.Rows)
+                    continue;
+
+                for (int k = 0; k < 4; k++)
+                {
+                    int xx = x - 2 + k;
+                    if ((bmp[i] & (0x8 >> k)) != 0 && xx >= 0 && xx < m_Frame.Columns)
+                    {
+                        m_Frame.Cells[yy * m_Frame.Columns + xx] = color;
+                        if (yy >= m_Frame.Height)
+                            m_Frame.Height = yy + 1;
+                    }
+                }
+            }
+
+            for (byte i = 0; i < cnt; i++)
+            {
+                unsigned long row = 0;
+                if (!ReadVarint(row) || row >= (unsigned long)m_Frame.Height)
+                    return false;
+
+                byte* pCells = m_Frame.Cells.data();
+                int cols = m_Frame.Columns;
+                memmove(pCells + row * cols, pCells + (row + 1) * cols, (m_Frame.Height - 1 - row) * cols);
+                memset(pCells + (m_Frame.Height - 1) * cols, 0, cols);
+                m_Frame.Height--;
+            }
+
+            return true;
+        }
+
+        bool ReadRecords()
+        {
+            for (;;)
+            {
+                byte tag = 0;
+                if (!ReadByte(tag))
+                    return false;
+
+                switch (tag)
+                {
+                case SpectatorEnd:
+                    return true;
+
+                case SpectatorLock:
+                    if (!ReadLock())
+                        return false;
+                    break;
+
+                case SpectatorBlocks:
+                    if (!ReadBlock(m_Frame.CurrentBlock) || !ReadBlock(m_Frame.NextBlock))
+                        return false;
+                    break;
+
+                case SpectatorPose:
+                {
+                    BlockSnapshot& current = m_Frame.CurrentBlock;
+                    int dx = 0;
+                    int dy = 0;
+                    byte oriIndex = 0;
+                    if (!current.IsValid || !ReadSigned(dx) || !ReadSigned(dy) || !ReadByte(oriIndex) ||
+                        !SetBlock(current, current.Color, current.X + dx, current.Y + dy, oriIndex))
+                    {
+                        return false;
+                    }
+                    break;
+                }
+
+                case SpectatorCounters:
+                {
+                    unsigned long points = 0;
+                    unsigned long lines = 0;
+                    byte flags = 0;
+                    if (!ReadByte(m_Frame.ActualLevel) || !ReadVarint(points) || !ReadVarint(lines) || !ReadByte(flags))
+                        return false;
+
+                    m_Frame.ActualPoints = (int)points;
+                    m_Frame.LinesCompleted = (int)lines;
+                    m_Frame.IsPaused = (flags & 1) != 0;
+                    m_Frame.GameOver = (flags & 2) != 0;
+                    break;
+                }
+
+                default:
+                    return false;
+                }
+            }
+        }
+    };
+}
+
+#endif
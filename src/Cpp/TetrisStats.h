@@ -0,0 +1,182 @@
+/*
+    Nanochord.Tetris
+
+    Hot path instrumentation counters and latency histograms
+
+    MIT License - see Tetris.h for details.
+
+    The instrumentation is compiled in only when TETRIS_INSTRUMENTATION is defined before including Tetris.h,
+    otherwise every instrumentation macro expands to nothing.
+ */
+
+#ifndef _Nanochord_TetrisStats_
+#define _Nanochord_TetrisStats_
+
+#include <stdio.h>
+
+#ifndef ARDUINO
+#include <chrono>
+#endif
+
+namespace Nanochord
+{
+    /// <summary>
+    /// Kinds of Host callbacks counted by the instrumentation
+    /// </summary>
+    enum HostCallKind
+    {
+        CallClearBackground,
+        CallDrawBlock,
+        CallDrawNextBlock,
+        CallClearBlock,
+        CallMoveBlock,
+        CallPaintPlayground,
+        CallPaintRows,
+        CallExecuteCommands,
+        CallPrint,
+        CallRandom,
+        CallTetrisEvent,
+        HostCallKindCount
+    };
+
+    /// <summary>
+    /// Histogram of operation latencies with power of two buckets.
+    /// The unit is nanoseconds on desktop targets and microseconds on Arduino.
+    /// </summary>
+    struct LatencyHistogram
+    {
+        static const int BucketCount = 32;
+
+        unsigned long Count;
+        unsigned long Min;
+        unsigned long Max;
+        unsigned long long Total;
+        unsigned long Buckets[BucketCount];     // Buckets[i] counts the samples in [2^i, 2^(i+1)), Buckets[0] also counts 0
+
+        void Reset()
+        {
+            Count = 0;
+            Min = 0;
+            Max = 0;
+            Total = 0;
+            for (int i = 0; i < BucketCount; i++)
+                Buckets[i] = 0;
+        }
+
+        void Record(unsigned long elapsed)
+        {
+            int bucket = 0;
+            for (unsigned long v = elapsed; v > 1 && bucket < BucketCount - 1; v >>= 1)
+                bucket++;
+
+            Buckets[bucket]++;
+            if (Count == 0 || elapsed < Min)
+                Min = elapsed;
+            if (elapsed > Max)
+                Max = elapsed;
+            Total += elapsed;
+            Count++;
+        }
+
+        // Returns the upper bound of the bucket which contains the specified percentile (0-100)
+        unsigned long GetPercentile(int percentile) const
+        {
+            unsigned long long limit = ((unsigned long long)Count * percentile + 99) / 100;
+            unsigned long long sum = 0;
+
+            for (int i = 0; i < BucketCount; i++)
+            {
+                sum += Buckets[i];
+                if (sum >= limit && sum > 0)
+                    return (2UL << i) - 1;
+            }
+
+            return Max;
+        }
+    };
+
+    /// <summary>
+    /// Counters collected by Playfield and Tetris when the instrumentation is enabled
+    /// </summary>
+    struct TetrisStats
+    {
+        unsigned long PlacementTests;
+        unsigned long Locks;
+        unsigned long RowsCleared;
+        unsigned long Allocations;
+        unsigned long HostCalls[HostCallKindCount];
+
+        LatencyHistogram RunLatency;
+        LatencyHistogram DropLatency;
+        LatencyHistogram RotateLatency;
+
+        TetrisStats()
+        {
+            Reset();
+        }
+
+        void Reset()
+        {
+            PlacementTests = 0;
+            Locks = 0;
+            RowsCleared = 0;
+            Allocations = 0;
+            for (int i = 0; i < HostCallKindCount; i++)
+                HostCalls[i] = 0;
+
+            RunLatency.Reset();
+            DropLatency.Reset();
+            RotateLatency.Reset();
+        }
+
+        static const char* GetHostCallName(int kind)
+        {
+            static const char* const names[HostCallKindCount] =
+            {
+                "ClearBackground", "DrawBlock", "DrawNextBlock", "ClearBlock", "MoveBlock",
+                "PaintPlayground", "PaintRows", "ExecuteCommands", "Print", "Random", "TetrisEvent"
+            };
+
+            return kind >= 0 && kind < HostCallKindCount ? names[kind] : "?";
+        }
+
+        // Returns the current time in the unit of the latency histograms
+        static unsigned long Now()
+        {
+#ifdef ARDUINO
+            return micros();
+#else
+            return (unsigned long)std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+        }
+    };
+
+    /// <summary>
+    /// Records the lifetime of the object into a latency histogram
+    /// </summary>
+    class ScopedLatency
+    {
+    public:
+        ScopedLatency(LatencyHistogram& histogram) : m_Histogram(histogram)
+        {
+            m_Start = TetrisStats::Now();
+        }
+
+        ~ScopedLatency()
+        {
+            m_Histogram.Record(TetrisStats::Now() - m_Start);
+        }
+
+    protected:
+        LatencyHistogram& m_Histogram;
+        unsigned long m_Start;
+    };
+}
+
+#define TETRIS_STAT_INC(stats, counter) ((stats).counter++)
+#define TETRIS_STAT_ADD(stats, counter, value) ((stats).counter += (value))
+#define TETRIS_STAT_HOST_CALL(stats, kind) ((stats).HostCalls[Nanochord::kind]++)
+#define TETRIS_STAT_LATENCY(stats, histogram) Nanochord::ScopedLatency tetrisLatency_##histogram((stats).histogram)
+
+#endif
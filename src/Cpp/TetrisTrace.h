@@ -0,0 +1,232 @@
+/*
+    Nanochord.Tetris
+
+    Timeline tracer which exports Chrome trace-event JSON (chrome://tracing, Perfetto)
+
+    MIT License - see Tetris.h for details.
+
+    The tracer is compiled in only when TETRIS_TRACING is defined before including Tetris.h, otherwise
+    TETRIS_TRACE_SCOPE expands to nothing. Every thread records into its own preallocated buffer, so recording
+    a span never locks and never allocates. When a buffer is full, further spans of that thread are dropped
+    and counted.
+ */
+
+#ifndef _Nanochord_TetrisTrace_
+#define _Nanochord_TetrisTrace_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace Nanochord
+{
+    /// <summary>
+    /// A completed span: name (static string), start and duration in nanoseconds
+    /// </summary>
+    struct TraceEvent
+    {
+        const char* Name;
+        uint64_t Start;
+        uint64_t Duration;
+    };
+
+    /// <summary>
+    /// Preallocated event buffer of one thread
+    /// </summary>
+    class TraceBuffer
+    {
+    public:
+        TraceBuffer(int threadId, size_t capacity)
+        {
+            m_ThreadId = threadId;
+            m_Events.resize(capacity);
+            m_Count.store(0);
+            m_Dropped.store(0);
+        }
+
+        void Add(const char* name, uint64_t start, uint64_t duration)
+        {
+            size_t idx = m_Count.load(std::memory_order_relaxed);
+            if (idx >= m_Events.size())
+            {
+                m_Dropped.fetch_add(1, std::memory_order_relaxed);
+                return;
+            }
+
+            TraceEvent& e = m_Events[idx];
+            e.Name = name;
+            e.Start = start;
+            e.Duration = duration;
+
+            m_Count.store(idx + 1, std::memory_order_release);
+        }
+
+        int GetThreadId() const { return m_ThreadId; }
+        size_t GetCount() const { return m_Count.load(std::memory_order_acquire); }
+        uint64_t GetDropped() const { return m_Dropped.load(std::memory_order_relaxed); }
+        const TraceEvent& GetEvent(size_t index) const { return m_Events[index]; }
+
+        void Clear()
+        {
+            m_Count.store(0, std::memory_order_release);
+            m_Dropped.store(0, std::memory_order_relaxed);
+        }
+
+    protected:
+        int m_ThreadId;
+        std::vector<TraceEvent> m_Events;
+        std::atomic<size_t> m_Count;
+        std::atomic<uint64_t> m_Dropped;
+    };
+
+    /// <summary>
+    /// Process wide tracer, which owns the buffers of all the threads that recorded anything
+    /// </summary>
+    class Tracer
+    {
+    public:
+        static const size_t DefaultCapacity = 1 << 16;
+
+        // Sets the number of events preallocated for every thread which starts recording after this call
+        static void SetThreadCapacity(size_t capacity) { GetState().Capacity = capacity; }
+
+        static void SetEnabled(bool enabled) { GetState().Enabled.store(enabled, std::memory_order_relaxed); }
+        static bool IsEnabled() { return GetState().Enabled.load(std::memory_order_relaxed); }
+
+        // Nanoseconds elapsed since the tracer was first used
+        static uint64_t Now()
+        {
+            return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - GetState().Epoch).count();
+        }
+
+        // Allocates the buffer of the calling thread, if it was not allocated yet.
+        // Calling it at thread start keeps the allocation out of the first traced frame.
+        static TraceBuffer& GetThreadBuffer()
+        {
+            static thread_local std::shared_ptr<TraceBuffer> buffer;
+
+            if (!buffer)
+            {
+                State& state = GetState();
+                std::lock_guard<std::mutex> lock(state.Lock);
+                buffer = std::make_shared<TraceBuffer>((int)state.Buffers.size() + 1, state.Capacity);
+                state.Buffers.push_back(buffer);
+            }
+
+            return *buffer;
+        }
+
+        // Writes the recorded events of every thread as Chrome trace-event JSON.
+        // It should be called while the traced threads are idle; the buffers are not cleared.
+        static bool WriteChromeTrace(FILE* pFile)
+        {
+            State& state = GetState();
+            std::lock_guard<std::mutex> lock(state.Lock);
+            bool first = true;
+
+            fprintf(pFile, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+
+            for (const std::shared_ptr<TraceBuffer>& buffer : state.Buffers)
+            {
+                fprintf(pFile, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"Tetris thread %d\"}}",
+                    first ? "" : ",", buffer->GetThreadId(), buffer->GetThreadId());
+                first = false;
+
+                size_t count = buffer->GetCount();
+                for (size_t i = 0; i < count; i++)
+                {
+                    const TraceEvent& e = buffer->GetEvent(i);
+                    fprintf(pFile, ",\n{\"name\":\"%s\",\"cat\":\"tetris\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}",
+                        e.Name, buffer->GetThreadId(), e.Start / 1000.0, e.Duration / 1000.0);
+                }
+
+                if (buffer->GetDropped() > 0)
+                {
+                    fprintf(pFile, ",\n{\"name\":\"dropped events\",\"ph\":\"C\",\"pid\":1,\"tid\":%d,\"ts\":0,\"args\":{\"count\":%llu}}",
+                        buffer->GetThreadId(), (unsigned long long)buffer->GetDropped());
+                }
+            }
+
+            fprintf(pFile, "\n]}\n");
+
+            return ferror(pFile) == 0;
+        }
+
+        // Writes the Chrome trace-event JSON into the specified file
+        static bool Flush(const char* path)
+        {
+            FILE* pFile = fopen(path, "w");
+            if (pFile == NULL)
+                return false;
+
+            bool res = WriteChromeTrace(pFile);
+            return fclose(pFile) == 0 && res;
+        }
+
+        // Forgets the recorded events of every thread
+        static void Clear()
+        {
+            State& state = GetState();
+            std::lock_guard<std::mutex> lock(state.Lock);
+
+            for (const std::shared_ptr<TraceBuffer>& buffer : state.Buffers)
+                buffer->Clear();
+        }
+
+    protected:
+        struct State
+        {
+            State() : Enabled(true), Capacity(DefaultCapacity), Epoch(std::chrono::steady_clock::now()) {}
+
+            std::atomic<bool> Enabled;
+            size_t Capacity;
+            std::chrono::steady_clock::time_point Epoch;
+            std::mutex Lock;
+            std::vector<std::shared_ptr<TraceBuffer> > Buffers;
+        };
+
+        static State& GetState()
+        {
+            static State state;
+            return state;
+        }
+    };
+
+    /// <summary>
+    /// Records a span from its construction until its destruction
+    /// </summary>
+    class TraceScope
+    {
+    public:
+        TraceScope(const char* name)
+        {
+            m_Name = Tracer::IsEnabled() ? name : NULL;
+            if (m_Name != NULL)
+                m_Start = Tracer::Now();
+        }
+
+        ~TraceScope()
+        {
+            if (m_Name != NULL)
+            {
+                uint64_t end = Tracer::Now();
+                Tracer::GetThreadBuffer().Add(m_Name, m_Start, end - m_Start);
+            }
+        }
+
+    protected:
+        const char* m_Name;
+        uint64_t m_Start = 0;
+    };
+}
+
+#define TETRIS_TRACE_CONCAT_(a, b) a##b
+#define TETRIS_TRACE_CONCAT(a, b) TETRIS_TRACE_CONCAT_(a, b)
+#define TETRIS_TRACE_SCOPE(name) Nanochord::TraceScope TETRIS_TRACE_CONCAT(tetrisTraceScope_, __LINE__)(name)
+
+#endif
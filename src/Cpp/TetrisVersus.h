@@ -0,0 +1,381 @@
+/*
+    Nanochord.Tetris
+
+    Versus mode: two games where completed rows send garbage rows to the opponent
+
+    MIT License - see Tetris.h for details.
+ */
+
+#ifndef _Nanochord_TetrisVersus_
+#define _Nanochord_TetrisVersus_
+
+#include "Tetris.h"
+#include "TetrisHeadless.h"
+#include <stdint.h>
+#include <string.h>
+#include <deque>
+#include <vector>
+
+namespace Nanochord
+{
+    /// <summary>
+    /// Playfield whose rows can be inserted at the bottom in constant time. Map points into a ring of row pointers
+    /// which contains every row twice, so inserting a row only moves the start of Map by one and reuses the empty
+    /// top row as the new bottom one. Removing a row moves the pointers of the rows above it instead of their cells.
+    /// Map changes when rows are inserted, it must not be stored.
+    /// </summary>
+    class VersusPlayfield : public Playfield
+    {
+    public:
+        VersusPlayfield(Host* pHost, int rows, int cols) : Playfield(pHost, rows, cols, NULL)
+        {
+            m_Cells.assign((size_t)m_Rows * m_Columns, 0);
+            m_Ring.resize(2 * (size_t)m_Rows);
+            for (int r = 0; r < m_Rows; r++)
+                m_Ring[r] = m_Ring[r + m_Rows] = &m_Cells[(size_t)r * m_Columns];
+
+            m_Start = 0;
+            m_ClearedRows = 0;
+            Map = &m_Ring[0];
+        }
+
+        // Returns the number of rows removed by ClearRow since the playfield was created
+        int GetClearedRows() const { return m_ClearedRows; }
+
+        void ClearRow(int y) override
+        {
+            TETRIS_STAT_INC(Stats, RowsCleared);
+
+            if (y >= m_Height)
+                return;
+
+            byte* pRow = Map[y];
+            for (int i = y + 1; i < m_Height; i++)
+                SetRow(i - 1, Map[i]);
+
+            memset(pRow, 0, m_Columns);
+            SetRow(m_Height - 1, pRow);
+
+            AddDamage(y, m_Height);
+            m_Height--;
+            m_ClearedRows++;
+        }
+
+        // Inserts a row below the stack, which moves up by one row. Every cell of the new row is occupied with the
+        // specified color except the hole column. Returns false (and inserts nothing) if the top row is occupied.
+        bool InsertGarbageRow(int holeColumn, byte color)
+        {
+            if (m_Height >= m_Rows)
+                return false;
+
+            // The empty top row becomes the bottom one
+            m_Start = m_Start == 0 ? m_Rows - 1 : m_Start - 1;
+            Map = &m_Ring[m_Start];
+
+            byte* pRow = Map[0];
+            memset(pRow, color, m_Columns);
+            if (holeColumn >= 0 && holeColumn < m_Columns)
+                pRow[holeColumn] = 0;
+
+            m_Height++;
+            AddDamage(0, m_Height);
+            return true;
+        }
+
+    protected:
+        std::vector<byte> m_Cells;
+        std::vector<byte*> m_Ring;      // 2 * rows pointers, the entries r and r + rows point to the same row
+        int m_Start;                    // Map is &m_Ring[m_Start]
+        int m_ClearedRows;
+
+        // Sets the row y of Map (both entries of the ring)
+        void SetRow(int y, byte* pRow)
+        {
+            int k = m_Start + y;
+            if (k >= m_Rows)
+                k -= m_Rows;
+
+            m_Ring[k] = pRow;
+            m_Ring[k + m_Rows] = pRow;
+        }
+    };
+
+    /// <summary>
+    /// An attack waiting to be inserted: a number of garbage rows with the same hole column
+    /// </summary>
+    struct GarbageEntry
+    {
+        int Rows;
+        int HoleColumn;
+    };
+
+    /// <summary>
+    /// The garbage rows sent to a player and not inserted yet, in the order of the attacks
+    /// </summary>
+    class GarbageQueue
+    {
+    public:
+        GarbageQueue()
+        {
+            m_PendingRows = 0;
+        }
+
+        int GetPendingRows() const { return m_PendingRows; }
+        bool IsEmpty() const { return m_PendingRows == 0; }
+
+        void Clear()
+        {
+            m_Entries.clear();
+            m_PendingRows = 0;
+        }
+
+        void Push(int rows, int holeColumn)
+        {
+            if (rows <= 0)
+                return;
+
+            GarbageEntry entry = { rows, holeColumn };
+            m_Entries.push_back(entry);
+            m_PendingRows += rows;
+        }
+
+        // Cancels up to the specified number of pending rows, the oldest ones first. Returns the rows which were not
+        // used for cancelling.
+        int Cancel(int rows)
+        {
+            while (rows > 0 && !m_Entries.empty())
+            {
+                GarbageEntry& entry = m_Entries.front();
+                int cnt = entry.Rows < rows ? entry.Rows : rows;
+
+                entry.Rows -= cnt;
+                m_PendingRows -= cnt;
+                rows -= cnt;
+
+                if (entry.Rows == 0)
+                    m_Entries.pop_front();
+            }
+
+            return rows;
+        }
+
+        // Removes up to maxRows rows of the oldest attack. Returns false if the queue is empty.
+        bool Take(int maxRows, GarbageEntry& taken)
+        {
+            if (m_Entries.empty() || maxRows <= 0)
+                return false;
+
+            GarbageEntry& entry = m_Entries.front();
+            taken.HoleColumn = entry.HoleColumn;
+            taken.Rows = entry.Rows < maxRows ? entry.Rows : maxRows;
+
+            entry.Rows -= taken.Rows;
+            m_PendingRows -= taken.Rows;
+            if (entry.Rows == 0)
+                m_Entries.pop_front();
+
+            return true;
+        }
+
+    protected:
+        std::deque<GarbageEntry> m_Entries;
+        int m_PendingRows;
+    };
+
+    class VersusMatch;
+
+    /// <summary>
+    /// A player of a VersusMatch. When a block touches down, the completed rows first cancel the pending garbage of
+    /// the player and the rest is sent to the opponent; a block which completes no row lets the pending garbage in
+    /// below the stack. The player loses if the garbage pushes the stack out of the playfield or into the falling block.
+    /// </summary>
+    class VersusTetris : public Tetris
+    {
+        friend class VersusMatch;
+
+    public:
+        VersusTetris(Host* pHost, int rows, int cols) : Tetris(pHost, &m_VersusPlayfield), m_VersusPlayfield(pHost, rows, cols)
+        {
+            m_pMatch = NULL;
+            m_LinesSent = 0;
+            m_LinesReceived = 0;
+        }
+
+        using Tetris::Run;
+
+        int Start() override
+        {
+            m_Incoming.Clear();
+            m_LinesSent = 0;
+            m_LinesReceived = 0;
+
+            return Tetris::Start();
+        }
+
+        const GarbageQueue& GetIncomingGarbage() const { return m_Incoming; }
+        const VersusPlayfield& GetVersusPlayfield() const { return m_VersusPlayfield; }
+
+        // Garbage rows sent to the opponent after cancelling, and garbage rows inserted into this playfield
+        int GetLinesSent() const { return m_LinesSent; }
+        int GetLinesReceived() const { return m_LinesReceived; }
+
+    protected:
+        VersusPlayfield m_VersusPlayfield;      // constructed after the Tetris base, which only stores its address
+        VersusMatch* m_pMatch;
+        GarbageQueue m_Incoming;
+        int m_LinesSent;
+        int m_LinesReceived;
+
+        int Run(PlacementTestResult* pres, bool isDropped) override;
+
+        // Inserts up to maxRows pending garbage rows and ends the game if they do not fit
+        void InsertGarbage(int maxRows, byte color)
+        {
+            GarbageEntry entry;
+            bool toppedOut = false;
+
+            while (!toppedOut && maxRows > 0 && m_Incoming.Take(maxRows, entry))
+            {
+                maxRows -= entry.Rows;
+                for (int i = 0; i < entry.Rows && !toppedOut; i++)
+                {
+                    if (m_VersusPlayfield.InsertGarbageRow(entry.HoleColumn, color))
+                    {
+                        m_LinesReceived++;
+#ifdef TETRIS_STATE_HASH
+                        m_BoardHash.InsertRow(BoardHash::GetRowKey(m_VersusPlayfield.Map[0], m_VersusPlayfield.GetColumns()));
+#endif
+                    }
+                    else
+                    {
+                        toppedOut = true;
+                    }
+                }
+            }
+
+            if (!toppedOut && !m_VersusPlayfield.HasDamage())
+                return;
+
+            if (toppedOut || m_Playfield.PlacementTest(m_pCurrentBlock->GetCurrentBitmap(), m_pCurrentBlock->X, m_pCurrentBlock->Y) != PlacementTestResult::Succeeded)
+            {
+                m_GameOver = true;
+                HostTetrisEvent(TetrisEventKind::GameOver);
+            }
+
+            HostPaintRows(&m_Playfield, m_Playfield.GetDamageFrom(), m_Playfield.GetDamageTo());
+            if (!m_GameOver)
+                HostDrawBlock(m_pCurrentBlock);
+            m_Playfield.ResetDamage();
+        }
+    };
+
+    /// <summary>
+    /// Two paired games. The players are driven like any Tetris game (Run, MoveLeft, Rotate, Drop...); the match
+    /// exchanges the garbage between them when their blocks touch down. The hole columns of the attacks come from
+    /// the random generator of the match, so a match is reproducible from its seed and the seeds of the hosts.
+    /// </summary>
+    class VersusMatch
+    {
+    public:
+        static const byte DefaultGarbageColor = 8;
+
+        VersusMatch(Host* pHost1, Host* pHost2, int rows, int cols, uint64_t seed = 1) : m_Random(seed)
+        {
+            m_pPlayers[0] = new VersusTetris(pHost1, rows, cols);
+            m_pPlayers[1] = new VersusTetris(pHost2, rows, cols);
+            m_pPlayers[0]->m_pMatch = this;
+            m_pPlayers[1]->m_pMatch = this;
+            m_MaxGarbagePerLock = 8;
+            m_GarbageColor = DefaultGarbageColor;
+        }
+
+        virtual ~VersusMatch()
+        {
+            delete m_pPlayers[0];
+            delete m_pPlayers[1];
+        }
+
+        // Starts both games
+        void Start()
+        {
+            m_pPlayers[0]->Start();
+            m_pPlayers[1]->Start();
+        }
+
+        // Restarts the random sequence of the hole columns
+        void Seed(uint64_t seed) { m_Random.Seed(seed); }
+
+        VersusTetris& GetPlayer(int index) { return *m_pPlayers[index]; }
+        const VersusTetris& GetPlayer(int index) const { return *m_pPlayers[index]; }
+
+        VersusTetris& GetOpponent(const VersusTetris& player)
+        {
+            return &player == m_pPlayers[0] ? *m_pPlayers[1] : *m_pPlayers[0];
+        }
+
+        bool IsOver() const { return m_pPlayers[0]->GetGameOver() || m_pPlayers[1]->GetGameOver(); }
+
+        // Returns the index of the player who won, or -1 while the match is running or if both games are over
+        int GetWinner() const
+        {
+            bool over0 = m_pPlayers[0]->GetGameOver();
+            bool over1 = m_pPlayers[1]->GetGameOver();
+            return over0 == over1 ? -1 : over0 ? 1 : 0;
+        }
+
+        // The number of garbage rows inserted at a touchdown without completed rows, the rest stays pending
+        int GetMaxGarbagePerLock() const { return m_MaxGarbagePerLock; }
+        void SetMaxGarbagePerLock(int rows) { m_MaxGarbagePerLock = rows; }
+
+        byte GetGarbageColor() const { return m_GarbageColor; }
+        void SetGarbageColor(byte color) { m_GarbageColor = color; }
+
+        // Returns the number of garbage rows sent for the specified number of rows completed by one block
+        virtual int GetAttack(int completedRows) const
+        {
+            static const int attacks[5] = { 0, 0, 1, 2, 4 };
+            return completedRows < 0 ? 0 : completedRows > 4 ? 4 : attacks[completedRows];
+        }
+
+        // Called by the players when a block touched down
+        virtual void OnTouchdown(VersusTetris& player, int completedRows)
+        {
+            if (completedRows == 0)
+            {
+                if (!player.GetGameOver())
+                    player.InsertGarbage(m_MaxGarbagePerLock, m_GarbageColor);
+                return;
+            }
+
+            int attack = player.m_Incoming.Cancel(GetAttack(completedRows));
+            if (attack > 0)
+            {
+                VersusTetris& opponent = GetOpponent(player);
+                opponent.m_Incoming.Push(attack, m_Random.Random(opponent.GetPlayfield().GetColumns()));
+                player.m_LinesSent += attack;
+            }
+        }
+
+    protected:
+        VersusTetris* m_pPlayers[2];
+        HeadlessHost m_Random;
+        int m_MaxGarbagePerLock;
+        byte m_GarbageColor;
+    };
+
+    inline int VersusTetris::Run(PlacementTestResult* pres, bool isDropped)
+    {
+        if (m_pCurrentBlock == NULL || m_IsPaused || m_GameOver)
+            return Tetris::Run(pres, isDropped);
+
+        int cleared = m_VersusPlayfield.GetClearedRows();
+        int interval = Tetris::Run(pres, isDropped);
+
+        if (*pres != PlacementTestResult::Succeeded && m_pMatch != NULL)
+            m_pMatch->OnTouchdown(*this, m_VersusPlayfield.GetClearedRows() - cleared);
+
+        return interval;
+    }
+}
+
+#endif
@@ -0,0 +1,177 @@
+
+#include <poll.h>
+#include <signal.h>
+#include <termios.h>
+#include "TerminalHost.h"
+
+const int ROWS = 20;
+const int COLS = 10;
+
+TerminalHost Host(ROWS, COLS);
+Nanochord::Tetris tetris(&Host, ROWS, COLS);
+Nanochord::Framebuffer Frame;
+
+struct termios originalTermios;
+volatile sig_atomic_t quitRequested = 0;
+
+void OnSignal(int)
+{
+    quitRequested = 1;
+}
+
+long long GetTickCount()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+void EnableRawMode()
+{
+    tcgetattr(STDIN_FILENO, &originalTermios);
+
+    struct termios raw = originalTermios;
+    raw.c_lflag &= ~(ICANON | ECHO);
+    raw.c_cc[VMIN] = 0;
+    raw.c_cc[VTIME] = 0;
+    tcsetattr(STDIN_FILENO, TCSAFLUSH, &raw);
+}
+
+void DisableRawMode()
+{
+    tcsetattr(STDIN_FILENO, TCSAFLUSH, &originalTermios);
+}
+
+// Reads the pending keys and applies them to the game. Returns false when the user quits.
+bool HandleKeys()
+{
+    char keys[64];
+    ssize_t cnt = read(STDIN_FILENO, keys, sizeof(keys));
+
+    for (ssize_t i = 0; i < cnt; i++)
+    {
+        if (keys[i] == '\x1b' && i + 2 < cnt && keys[i + 1] == '[')
+        {
+            switch (keys[i + 2])
+            {
+            case 'A': // Up arrow
+                tetris.Rotate();
+                break;
+            case 'B': // Down arrow
+                tetris.Drop();
+                break;
+            case 'C': // Right arrow
+                tetris.MoveRight();
+                break;
+            case 'D': // Left arrow
+                tetris.MoveLeft();
+                break;
+            }
+            i += 2;
+        }
+        else
+        {
+            switch (keys[i])
+            {
+            case 'p':
+            case 'P':
+                tetris.Pause();
+                break;
+            case 'q':
+            case 'Q':
+                return false;
+            case ' ':
+            case '\n':
+                if (tetris.GetGameOver())
+                    tetris.Start();
+                break;
+            }
+        }
+    }
+
+    return true;
+}
+
+// Plays random moves, e.g. for soak tests over SSH
+void PlayRandomMove()
+{
+    switch (rand() % 8)
+    {
+    case 0:
+        tetris.MoveLeft();
+        break;
+    case 1:
+        tetris.MoveRight();
+        break;
+    case 2:
+        tetris.Rotate();
+        break;
+    case 3:
+        tetris.Drop();
+        break;
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    bool autoPlay = false;
+    long maxFrames = -1;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--auto") == 0)
+            autoPlay = true;
+        else if (strncmp(argv[i], "--frames=", 9) == 0)
+            maxFrames = atol(argv[i] + 9);
+    }
+
+    signal(SIGINT, OnSignal);
+    signal(SIGTERM, OnSignal);
+
+    EnableRawMode();
+
+    int tetrisLevel = tetris.Start();
+    tetris.SetFramebuffer(&Frame);
+
+    long long lastTickCount = GetTickCount();
+    long frames = 0;
+    size_t totalBytes = 0;
+
+    while (!quitRequested && (maxFrames < 0 || frames < maxFrames))
+    {
+        // Waits for a key or the next frame (60 Hz)
+        struct pollfd pfd = { STDIN_FILENO, POLLIN, 0 };
+        poll(&pfd, 1, 16);
+
+        if (!HandleKeys())
+            break;
+
+        if (autoPlay)
+        {
+            if (tetris.GetGameOver())
+                tetris.Start();
+            else
+                PlayRandomMove();
+        }
+
+        long long m = GetTickCount();
+        long long delay = autoPlay ? 10 : (11 - tetrisLevel) * 50;
+        if (m - lastTickCount > delay && !tetris.GetGameOver())
+        {
+            tetrisLevel = tetris.Run();
+            lastTickCount = m;
+        }
+
+        // Nothing is written when nothing changed
+        totalBytes += Host.Render(tetris, Frame);
+
+        frames++;
+    }
+
+    Host.Restore();
+    DisableRawMode();
+
+    fprintf(stderr, "%ld frames, %lu bytes written\n", frames, (unsigned long)totalBytes);
+
+    return 0;
+}
@@ -0,0 +1,271 @@
+#pragma once
+
+#include "Tetris.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string>
+#include <vector>
+
+/// <summary>
+/// POSIX terminal host. The game state is pulled from a Framebuffer and composed into a back buffer of character
+/// cells. Only the cells which differ from the front buffer (what is on the screen) are sent as ANSI escape
+/// sequences, and the whole frame goes out with a single write().
+/// </summary>
+class TerminalHost : public Nanochord::Host
+{
+public:
+    TerminalHost(int rows, int cols)
+    {
+        m_rows = rows;
+        m_cols = cols;
+
+        // Every playfield cell is two characters wide, the side panel is on the right
+        m_width = 2 * m_cols + 2 + PanelWidth;
+        m_height = m_rows + 4;
+
+        m_front.assign(m_width * m_height, Cell());
+        m_back.assign(m_width * m_height, Cell());
+        m_output.reserve(16 * m_width * m_height);
+
+        Invalidate();
+        srand(time(0));
+    }
+
+
+    // Host interface. Drawing happens in Render, from the framebuffer.
+
+    void ClearBackground() override {}
+    void DrawBlock(const Nanochord::Block* pBlock) override {}
+    void DrawNextBlock(const Nanochord::Block* pBlock) override {}
+    void ClearBlock(const Nanochord::Block* pBlock) override {}
+    void PaintPlayground(const Nanochord::Playfield* pPlayfield) override {}
+
+    void Print(const char* text) override
+    {
+        fputs(text, stderr);
+    }
+
+    int Random(int max) override
+    {
+        return rand() % max;
+    }
+
+    void TetrisEvent(Nanochord::TetrisEventKind kind) override
+    {
+        // Add custom event handling here...
+    }
+
+    // Functions
+
+    // Forces the next Render to redraw every cell, e.g. after the screen was cleared
+    void Invalidate()
+    {
+        for (size_t i = 0; i < m_front.size(); i++)
+            m_front[i].Ch = 0;
+        m_clearScreen = true;
+    }
+
+    // Composes the frame and writes the changes to the terminal. Returns the number of bytes written.
+    size_t Render(const Nanochord::Tetris& tetris, const Nanochord::Framebuffer& framebuffer)
+    {
+        Compose(tetris, framebuffer);
+        return Flush();
+    }
+
+    // Restores the terminal colors and shows the cursor again below the game
+    void Restore()
+    {
+        char text[32];
+        snprintf(text, sizeof(text), "\x1b[0m\x1b[%d;1H\x1b[?25h", m_height + 1);
+        WriteAll(text, strlen(text));
+    }
+
+    size_t GetLastFrameBytes() const { return m_output.size(); }
+
+protected:
+    static const int PanelWidth = 24;
+
+    /// <summary>
+    /// Character cell of the terminal
+    /// </summary>
+    struct Cell
+    {
+        char Ch = ' ';
+        byte Color = 0;         // background color: 0 is the default, otherwise a block color
+
+        bool operator==(const Cell& other) const { return Ch == other.Ch && Color == other.Color; }
+        bool operator!=(const Cell& other) const { return !(*this == other); }
+    };
+
+    int m_rows;
+    int m_cols;
+    int m_width;
+    int m_height;
+    bool m_clearScreen;
+    std::vector<Cell> m_front;      // content of the screen
+    std::vector<Cell> m_back;       // frame being composed
+    std::string m_output;           // escape sequences of the frame, reused between frames
+
+    void Put(int x, int y, char ch, byte color = 0)
+    {
+        if (x >= 0 && y >= 0 && x < m_width && y < m_height)
+        {
+            Cell& cell = m_back[y * m_width + x];
+            cell.Ch = ch;
+            cell.Color = color;
+        }
+    }
+
+    void PutText(int x, int y, const char* text)
+    {
+        for (int i = 0; text[i] != 0; i++)
+            Put(x + i, y, text[i]);
+    }
+
+    void Compose(const Nanochord::Tetris& tetris, const Nanochord::Framebuffer& framebuffer)
+    {
+        for (size_t i = 0; i < m_back.size(); i++)
+            m_back[i] = Cell();
+
+        // Border
+        int right = 2 * m_cols + 1;
+        for (int x = 1; x < right; x++)
+        {
+            Put(x, 0, '-');
+            Put(x, m_rows + 1, '-');
+        }
+        for (int y = 1; y <= m_rows; y++)
+        {
+            Put(0, y, '|');
+            Put(right, y, '|');
+        }
+        Put(0, 0, '+');
+        Put(right, 0, '+');
+        Put(0, m_rows + 1, '+');
+        Put(right, m_rows + 1, '+');
+
+        // Playfield, the top row first
+        for (int y = 0; y < m_rows && y < framebuffer.GetRows(); y++)
+        {
+            for (int x = 0; x < m_cols && x < framebuffer.GetColumns(); x++)
+            {
+                byte color = framebuffer.GetCell(x, y);
+                Put(1 + 2 * x, m_rows - y, ' ', color);
+                Put(2 + 2 * x, m_rows - y, ' ', color);
+            }
+        }
+
+        // Side panel
+        char text[32];
+        int px = right + 3;
+
+        snprintf(text, sizeof(text), "Level:  %d", (int)tetris.GetActualLevel());
+        PutText(px, 1, text);
+        snprintf(text, sizeof(text), "Points: %d", tetris.GetActualPoints());
+        PutText(px, 2, text);
+        snprintf(text, sizeof(text), "Lines:  %d", tetris.GetLinesCompleted());
+        PutText(px, 3, text);
+
+        PutText(px, 5, "Next block:");
+        const byte* bmp = framebuffer.GetNextBitmap();
+        for (int i = 0; i < 4; i++)
+        {
+            for (int k = 0; k < 4; k++)
+            {
+                byte color = (bmp[i] & (0x8 >> k)) != 0 ? framebuffer.GetNextColor() : 0;
+                Put(px + 2 * k, 6 + i, ' ', color);
+                Put(px + 2 * k + 1, 6 + i, ' ', color);
+            }
+        }
+
+        if (tetris.GetGameOver())
+            PutText(px, 11, "** GAME OVER **");
+        else if (tetris.GetIsPaused())
+            PutText(px, 11, "** GAME PAUSED **");
+
+        // Two short lines, so the help fits the frame of the narrowest (10 columns) board
+        PutText(0, m_rows + 2, "Arrows: move, Up: rotate");
+        PutText(0, m_rows + 3, "Down: drop, P: pause, Q: quit");
+    }
+
+    // Sends the difference of the back and front buffers to the terminal
+    size_t Flush()
+    {
+        // Block colors of the library mapped to the ANSI colors
+        static const int ansiColors[8] = { 0, 1, 2, 4, 3, 6, 5, 7 };
+
+        char seq[32];
+        int cursorX = -1;
+        int cursorY = -1;
+        int color = -1;
+
+        m_output.clear();
+
+        if (m_clearScreen)
+        {
+            m_output += "\x1b[0m\x1b[?25l\x1b[2J";
+            m_clearScreen = false;
+            color = 0;
+        }
+
+        for (int y = 0; y < m_height; y++)
+        {
+            for (int x = 0; x < m_width; x++)
+            {
+                int i = y * m_width + x;
+                if (m_back[i] == m_front[i])
+                    continue;
+
+                if (x != cursorX || y != cursorY)
+                {
+                    snprintf(seq, sizeof(seq), "\x1b[%d;%dH", y + 1, x + 1);
+                    m_output += seq;
+                }
+
+                if (m_back[i].Color != color)
+                {
+                    color = m_back[i].Color;
+                    if (color == 0)
+                        snprintf(seq, sizeof(seq), "\x1b[0m");
+                    else
+                        snprintf(seq, sizeof(seq), "\x1b[4%dm", ansiColors[color & 7]);
+                    m_output += seq;
+                }
+
+                m_output += m_back[i].Ch;
+                m_front[i] = m_back[i];
+                cursorX = x + 1;
+                cursorY = y;
+            }
+        }
+
+        if (color > 0)
+            m_output += "\x1b[0m";
+
+        if (!m_output.empty())
+            WriteAll(m_output.data(), m_output.size());
+
+        return m_output.size();
+    }
+
+    static void WriteAll(const char* data, size_t size)
+    {
+        while (size > 0)
+        {
+            ssize_t res = write(STDOUT_FILENO, data, size);
+            if (res < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                return;
+            }
+
+            data += res;
+            size -= res;
+        }
+    }
+};
@@ -10,6 +10,7 @@ const int COLS = 20;
 
 ConsoleHost Host(ROWS, COLS);
 Nanochord::Tetris tetris(&Host, ROWS, COLS);
+Nanochord::RenderCommandBuffer Commands(256);
 
 int main()
 {
@@ -18,6 +19,9 @@ int main()
 
     Host.DrawPlayground();
 
+    // The screen is updated once per loop iteration with the recorded commands
+    tetris.SetCommandBuffer(&Commands);
+
     int tetrisLevel = tetris.Start();
 
     DWORD lastTickCount = ::GetTickCount();
@@ -82,6 +86,8 @@ int main()
             ConsoleHost::DisplayValues(tetris.GetActualLevel(), tetris.GetActualPoints());
         }
 
+        tetris.FlushCommands();
+
     }
 
     return 0;
@@ -4,6 +4,7 @@
 #include <cstdlib>
 #include <time.h>
 #include <iostream> 
+#include <vector>
 #include <Windows.h>
 
 using namespace std;
@@ -14,6 +15,7 @@ private:
     int m_rows;
     int m_cols;
     int m_indent;
+    vector<int> m_frame;    // final color of every cell in a flushed frame, -1 means unchanged
 
 public:
     ConsoleHost(int rows, int cols)
@@ -64,17 +66,89 @@ public:
         DrawBlock(pBlock, 0, m_indent + 1, 3, m_rows);
     }
 
+    bool MoveBlock(const Nanochord::Block* pBlock, const Nanochord::BlockMove* pMove) override
+    {
+        for (int i = 0; i < pMove->EraseCount; i++)
+            DrawPixel(pMove->Erase[i].X, pMove->Erase[i].Y, 0, m_indent + 1, 3, m_rows);
+
+        for (int i = 0; i < pMove->PaintCount; i++)
+            DrawPixel(pMove->Paint[i].X, pMove->Paint[i].Y, pBlock->Color, m_indent + 1, 3, m_rows);
+
+        SetCursorPosition(80, 0);
+        return true;
+    }
+
     void PaintPlayground(const Nanochord::Playfield* pPlayfield) override
     {
-        for (byte y = 0; y < m_rows; y++)
+        PaintRows(pPlayfield, 0, m_rows);
+    }
+
+    void PaintRows(const Nanochord::Playfield* pPlayfield, int fromRow, int toRow) override
+    {
+        for (int y = fromRow; y < toRow; y++)
         {
             for (byte x = 0; x < m_cols; x++)
             {
-                DrawPixel(x, y, pPlayfield->Map[y][x], m_indent + 1, 3, m_rows);
+                DrawPixel(x, y, pPlayfield->GetCell(x, y), m_indent + 1, 3, m_rows);
             }
         }
     }
 
+    void ExecuteCommands(const Nanochord::Playfield* pPlayfield, const Nanochord::RenderCommandBuffer* pCommands) override
+    {
+        // Only the final color of each changed cell is written, one write per run of equal colors in a row
+        m_frame.assign(m_rows * m_cols, -1);
+
+        for (int i = 0; i < pCommands->GetCount(); i++)
+        {
+            const Nanochord::RenderCommand& cmd = pCommands->GetCommand(i);
+
+            switch (cmd.Kind)
+            {
+            case Nanochord::RenderClearBackground:
+                m_frame.assign(m_rows * m_cols, 0);
+                break;
+            case Nanochord::RenderFillCell:
+                if (cmd.X < m_cols && cmd.Y < m_rows)
+                    m_frame[cmd.Y * m_cols + cmd.X] = cmd.Color;
+                break;
+            case Nanochord::RenderPaintRows:
+                for (int y = cmd.Y; y < cmd.Y + cmd.Count && y < m_rows; y++)
+                    for (int x = 0; x < m_cols; x++)
+                        m_frame[y * m_cols + x] = pPlayfield->GetCell(x, y);
+                break;
+            case Nanochord::RenderNextBlock:
+                for (int r = 0; r < 4; r++)
+                    for (int x = 0; x < 4; x++)
+                        DrawPixel(x, r, (cmd.Bitmap[r] & (0x8 >> x)) != 0 ? cmd.Color : 0, 4, 7, 4);
+                break;
+            }
+        }
+
+        for (int y = 0; y < m_rows; y++)
+        {
+            int x = 0;
+            while (x < m_cols)
+            {
+                int color = m_frame[y * m_cols + x];
+                int end = x + 1;
+                while (end < m_cols && m_frame[y * m_cols + end] == color)
+                    end++;
+
+                if (color >= 0)
+                {
+                    SetColor(color, color);
+                    SetCursorPosition(m_indent + 1 + x, 3 + (m_rows - y));
+                    cout << string(end - x, ' ');
+                }
+
+                x = end;
+            }
+        }
+
+        SetCursorPosition(80, 0);
+    }
+
     void Print(const char* text) override
     {
         cerr << text;